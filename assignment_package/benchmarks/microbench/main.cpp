@@ -0,0 +1,454 @@
+// Times the engine's hot CPU kernels on fixed inputs and, given a baseline
+// written by an earlier run, flags any that got slower or started
+// returning different results. Run with --help for the options.
+#include "terrain.h"
+#include "terraingenerator.h"
+#include "player.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Every input comes from this seed, so every run times the same work
+static const unsigned int SEED = 1234;
+// How many precomputed inputs each benchmark cycles through
+static const size_t INPUTS = 4096;
+// Each benchmark's checksum covers this many calls (unless it says otherwise),
+// however many it was timed over
+static const size_t CHECK_ITERATIONS = 1024;
+
+struct Options {
+    // Only run benchmarks whose names contain this
+    std::string filter;
+    // Timed batches per benchmark; the median is reported
+    int repetitions = 9;
+    // How long each batch should take
+    double batchMillis = 50.0;
+    // Where to write the results as JSON, if anywhere
+    std::string jsonPath;
+    // Results of an earlier run to compare against, if any
+    std::string baselinePath;
+    // How much slower than the baseline, in percent, counts as a regression
+    double thresholdPercent = 10.0;
+};
+
+// Runs its kernel the given number of times and returns a hash of the
+// results, which also keeps the compiler from optimizing the calls away
+struct Benchmark {
+    std::string name;
+    std::function<uint64_t(size_t)> run;
+    // Kernels that always get the same input only need one call checked
+    size_t checkIterations = CHECK_ITERATIONS;
+};
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0.0;
+    double minNsPerOp = 0.0;
+    // Median absolute deviation of the batches, as a percentage of the median
+    double deviationPercent = 0.0;
+    size_t iterations = 0;
+    uint64_t checksum = 0;
+};
+
+// FNV-1a, one value at a time
+static void mix(uint64_t &hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (8 * i)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+}
+
+static void mix(uint64_t &hash, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    mix(hash, static_cast<uint64_t>(bits));
+}
+
+static const uint64_t HASH_START = 14695981039346656037ull;
+
+// Cheap enough not to skew the timing, but changes along with the mesh
+static void mixMesh(uint64_t &hash, const ChunkMesh &mesh) {
+    mix(hash, static_cast<uint64_t>(mesh.stats.visibleFaces));
+    mix(hash, static_cast<uint64_t>(mesh.stats.hiddenFaces));
+    mix(hash, static_cast<uint64_t>(mesh.stats.quads));
+    mix(hash, static_cast<uint64_t>(mesh.vbo.size()));
+    mix(hash, static_cast<uint64_t>(mesh.tpVbo.size()));
+    if (!mesh.vbo.empty()) {
+        mix(hash, static_cast<uint64_t>(mesh.vbo.back().pos) << 32 | mesh.vbo.back().tex);
+    }
+}
+
+// The face counts of the fixture's middle Chunk, which only change when face
+// culling or the terrain generator do. Checked on every run, baseline or not.
+struct ExpectedMesh {
+    MeshMode mode;
+    const char *name;
+    unsigned int visibleFaces;
+    unsigned int hiddenFaces;
+    unsigned int quads;
+};
+
+static const ExpectedMesh EXPECTED_MESHES[] = {
+    {GREEDY, "greedy", 7776, 205194, 3409},
+    {PER_FACE, "per face", 7776, 205194, 7776},
+};
+
+// Returns how many of the meshes above came out with different counts
+static int checkMeshCounts(const ChunkSnapshot &snapshot) {
+    int failures = 0;
+    for (const ExpectedMesh &expected : EXPECTED_MESHES) {
+        MeshStats stats = Chunk::buildMesh(snapshot, expected.mode).stats;
+        if (stats.visibleFaces != expected.visibleFaces || stats.hiddenFaces != expected.hiddenFaces ||
+            stats.quads != expected.quads) {
+            std::printf("Mesh (%s) has %u visible faces, %u hidden, %u quads; expected %u, %u, %u\n",
+                        expected.name, stats.visibleFaces, stats.hiddenFaces, stats.quads,
+                        expected.visibleFaces, expected.hiddenFaces, expected.quads);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static void printUsage(const char *program) {
+    std::printf("Usage: %s [--filter TEXT] [--repetitions N] [--batch-ms MS]\n"
+                "          [--json FILE] [--baseline FILE] [--threshold PERCENT]\n"
+                "  --filter TEXT        only run benchmarks whose names contain TEXT\n"
+                "  --repetitions N      timed batches per benchmark (default 9)\n"
+                "  --batch-ms MS        length of each batch (default 50)\n"
+                "  --json FILE          write the results to FILE, e.g. to use as a baseline\n"
+                "  --baseline FILE      compare against results written by --json\n"
+                "  --threshold PERCENT  slowdown that counts as a regression (default 10)\n"
+                "Exits with 2 if any benchmark regressed or changed its results, or if\n"
+                "the fixture Chunk's mesh doesn't have the expected face counts.\n",
+                program);
+}
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--repetitions" && std::atoi(value) > 0) {
+            options.repetitions = std::atoi(value);
+        } else if (arg == "--batch-ms" && std::atof(value) > 0) {
+            options.batchMillis = std::atof(value);
+        } else if (arg == "--json") {
+            options.jsonPath = value;
+        } else if (arg == "--baseline") {
+            options.baselinePath = value;
+        } else if (arg == "--threshold" && std::atof(value) >= 0) {
+            options.thresholdPercent = std::atof(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+static double secondsFor(const Benchmark &benchmark, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    benchmark.run(iterations);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result measure(const Benchmark &benchmark, const Options &options) {
+    Result result;
+    result.name = benchmark.name;
+    result.checksum = benchmark.run(benchmark.checkIterations);
+
+    // Double the batch until it takes a measurable while, then scale it to
+    // the requested length
+    size_t iterations = 1;
+    double seconds = secondsFor(benchmark, iterations);
+    while (seconds < options.batchMillis / 1e3 / 10 && iterations < (size_t(1) << 40)) {
+        iterations *= 2;
+        seconds = secondsFor(benchmark, iterations);
+    }
+    iterations = std::max<size_t>(1, static_cast<size_t>(iterations * (options.batchMillis / 1e3) / seconds));
+    result.iterations = iterations;
+
+    std::vector<double> nsPerOp;
+    for (int r = 0; r < options.repetitions; r++) {
+        nsPerOp.push_back(secondsFor(benchmark, iterations) * 1e9 / iterations);
+    }
+    result.nsPerOp = median(nsPerOp);
+    result.minNsPerOp = *std::min_element(nsPerOp.begin(), nsPerOp.end());
+    std::vector<double> deviations;
+    for (double ns : nsPerOp) {
+        deviations.push_back(std::abs(ns - result.nsPerOp));
+    }
+    result.deviationPercent = 100.0 * median(deviations) / result.nsPerOp;
+    return result;
+}
+
+static bool writeJson(const std::vector<Result> &results, const Options &options) {
+    QJsonArray benchmarks;
+    for (const Result &result : results) {
+        QJsonObject entry;
+        entry["name"] = QString::fromStdString(result.name);
+        entry["ns_per_op"] = result.nsPerOp;
+        entry["min_ns_per_op"] = result.minNsPerOp;
+        entry["deviation_percent"] = result.deviationPercent;
+        entry["iterations"] = static_cast<double>(result.iterations);
+        // As a string, since JSON numbers can't hold all 64 bits
+        entry["checksum"] = QString::number(static_cast<qulonglong>(result.checksum), 16);
+        benchmarks.append(entry);
+    }
+    QJsonObject root;
+    root["seed"] = static_cast<int>(SEED);
+    root["repetitions"] = options.repetitions;
+    root["benchmarks"] = benchmarks;
+
+    QFile file(QString::fromStdString(options.jsonPath));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    return true;
+}
+
+// Returns how many benchmarks regressed or changed their results, or -1 if
+// the baseline can't be read
+static int compareToBaseline(const std::vector<Result> &results, const Options &options) {
+    QFile file(QString::fromStdString(options.baselinePath));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    if (!document.isObject()) {
+        return -1;
+    }
+
+    std::map<std::string, QJsonObject> baseline;
+    for (const QJsonValue &value : document.object().value("benchmarks").toArray()) {
+        QJsonObject entry = value.toObject();
+        baseline[entry.value("name").toString().toStdString()] = entry;
+    }
+
+    std::printf("\n%-34s %12s %12s %8s\n", "Compared to baseline", "baseline ns", "current ns", "change");
+    int failures = 0;
+    for (const Result &result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            std::printf("%-34s %12s %12.1f %8s  new\n", result.name.c_str(), "-", result.nsPerOp, "-");
+            continue;
+        }
+        double before = it->second.value("ns_per_op").toDouble();
+        double change = 100.0 * (result.nsPerOp - before) / before;
+        const char *verdict = "";
+        if (it->second.value("checksum").toString() != QString::number(static_cast<qulonglong>(result.checksum), 16)) {
+            verdict = "  OUTPUT CHANGED";
+            failures++;
+        } else if (change > options.thresholdPercent) {
+            verdict = "  REGRESSION";
+            failures++;
+        } else if (change < -options.thresholdPercent) {
+            verdict = "  faster";
+        }
+        std::printf("%-34s %12.1f %12.1f %+7.1f%%%s\n", result.name.c_str(), before, result.nsPerOp, change, verdict);
+    }
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(SEED);
+    auto uniform = [&](float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    };
+    auto uniformInt = [&](int lo, int hi) {
+        return std::uniform_int_distribution<int>(lo, hi)(rng);
+    };
+
+    // The fixture world: the 3 x 3 Chunks at [0, 48) x [0, 48), generated
+    // as the game would. The middle Chunk has all four neighbors.
+    std::printf("Generating fixture Chunks...\n");
+    Terrain terrain(nullptr);
+    terrain.CreateProceduralTerrain(0, 48, 0, 48);
+    const Chunk &middle = *terrain.getChunkAt(16, 16);
+    uPtr<ChunkSnapshot> snapshot = middle.snapshot();
+    TerrainGenerator generator;
+    int meshFailures = checkMeshCounts(*snapshot);
+
+    std::vector<glm::vec2> points2D;
+    std::vector<glm::vec3> points3D;
+    std::vector<glm::ivec3> blocks;
+    std::vector<glm::ivec3> chunkBlocks;
+    std::vector<glm::vec4> biomes;
+    std::vector<glm::vec3> rayOrigins;
+    std::vector<glm::vec3> rayDirections;
+    for (size_t i = 0; i < INPUTS; i++) {
+        points2D.push_back(glm::vec2(uniform(-1000.f, 1000.f), uniform(-1000.f, 1000.f)));
+        points3D.push_back(glm::vec3(uniform(-100.f, 100.f), uniform(-100.f, 100.f), uniform(-100.f, 100.f)));
+        blocks.push_back(glm::ivec3(uniformInt(0, 47), uniformInt(0, 255), uniformInt(0, 47)));
+        chunkBlocks.push_back(glm::ivec3(uniformInt(0, 15), uniformInt(0, 255), uniformInt(0, 15)));
+        // x, z, b1, b2 for calcHeight and biomeBlock
+        biomes.push_back(glm::vec4(uniformInt(-100000, 100000), uniformInt(-100000, 100000),
+                                   uniform(0.f, 1.f), uniform(0.f, 1.f)));
+        // Player-sized steps, like the collision rays, through the fixture
+        rayOrigins.push_back(glm::vec3(uniform(8.f, 40.f), uniform(100.f, 160.f), uniform(8.f, 40.f)));
+        glm::vec3 direction(uniform(-1.f, 1.f), uniform(-1.f, 1.f), uniform(-1.f, 1.f));
+        rayDirections.push_back(glm::normalize(direction) * uniform(0.25f, 3.f));
+    }
+
+    std::vector<Benchmark> benchmarks = {
+        {"TerrainGenerator::PerlinNoise", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                mix(hash, generator.PerlinNoise(points2D[i % INPUTS]));
+            }
+            return hash;
+        }},
+        {"TerrainGenerator::fbm", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                mix(hash, generator.fbm(points2D[i % INPUTS] / 256.f));
+            }
+            return hash;
+        }},
+        {"TerrainGenerator::WorleyNoise", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                mix(hash, generator.WorleyNoise(points2D[i % INPUTS]));
+            }
+            return hash;
+        }},
+        {"TerrainGenerator::perlinNoise3D", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                mix(hash, generator.perlinNoise3D(points3D[i % INPUTS]));
+            }
+            return hash;
+        }},
+        {"TerrainGenerator::calcHeight", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                const glm::vec4 &b = biomes[i % INPUTS];
+                mix(hash, static_cast<uint64_t>(generator.calcHeight(b.x, b.y, b.z, b.w)));
+            }
+            return hash;
+        }},
+        {"TerrainGenerator::biomeBlock", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                const glm::vec4 &b = biomes[i % INPUTS];
+                int y = blocks[i % INPUTS].y;
+                mix(hash, static_cast<uint64_t>(generator.biomeBlock(b.x, y, b.y, 140, b.z, b.w)));
+            }
+            return hash;
+        }},
+        {"Chunk::getBlockAt", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                const glm::ivec3 &p = chunkBlocks[i % INPUTS];
+                mix(hash, static_cast<uint64_t>(middle.getBlockAt(p.x, p.y, p.z)));
+            }
+            return hash;
+        }},
+        {"Terrain::getBlockAt", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                const glm::ivec3 &p = blocks[i % INPUTS];
+                mix(hash, static_cast<uint64_t>(terrain.getBlockAt(p.x, p.y, p.z)));
+            }
+            return hash;
+        }},
+        {"Chunk::snapshot", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                uPtr<ChunkSnapshot> copy = middle.snapshot();
+                mix(hash, static_cast<uint64_t>(copy->getBlockAt(-1, 128, 8)));
+            }
+            return hash;
+        }, 1},
+        {"Chunk::buildMesh (greedy)", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                ChunkMesh mesh = Chunk::buildMesh(*snapshot, GREEDY);
+                mixMesh(hash, mesh);
+            }
+            return hash;
+        }, 1},
+        {"Chunk::buildMesh (per face)", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                ChunkMesh mesh = Chunk::buildMesh(*snapshot, PER_FACE);
+                mixMesh(hash, mesh);
+            }
+            return hash;
+        }, 1},
+        {"Player::gridMarch", [&](size_t n) {
+            uint64_t hash = HASH_START;
+            for (size_t i = 0; i < n; i++) {
+                float dist = 0.f;
+                glm::ivec3 hit(0);
+                bool found = Player::gridMarch(rayOrigins[i % INPUTS], rayDirections[i % INPUTS], terrain,
+                                               false, &dist, &hit);
+                mix(hash, dist);
+                mix(hash, static_cast<uint64_t>(found ? hit.x * 65536 + hit.y * 256 + hit.z : -1));
+            }
+            return hash;
+        }},
+    };
+
+    std::vector<Result> results;
+    std::printf("%-34s %12s %12s %8s %12s\n", "Benchmark", "ns/op", "min ns/op", "+/-", "iterations");
+    for (const Benchmark &benchmark : benchmarks) {
+        if (benchmark.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        Result result = measure(benchmark, options);
+        std::printf("%-34s %12.1f %12.1f %7.1f%% %12zu\n", result.name.c_str(), result.nsPerOp,
+                    result.minNsPerOp, result.deviationPercent, result.iterations);
+        results.push_back(result);
+    }
+
+    if (!options.jsonPath.empty() && !writeJson(results, options)) {
+        std::fprintf(stderr, "Could not write %s\n", options.jsonPath.c_str());
+        return 1;
+    }
+    if (meshFailures > 0) {
+        std::printf("\nFace culling changed: the fixture's mesh counts differ from the expected ones\n");
+        return 2;
+    }
+    if (!options.baselinePath.empty()) {
+        int failures = compareToBaseline(results, options);
+        if (failures < 0) {
+            std::fprintf(stderr, "Could not read baseline %s\n", options.baselinePath.c_str());
+            return 1;
+        }
+        if (failures > 0) {
+            std::printf("\n%d benchmark%s regressed by more than %.0f%% or changed output\n", failures,
+                        failures == 1 ? "" : "s", options.thresholdPercent);
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+# Microbenchmarks of the engine's hot CPU kernels, with a comparison mode
+# that flags regressions against a stored baseline. Terrain and Player pull
+# in the GL headers, but nothing here creates a widget or a GL context.
+#   qmake microbench.pro && make && ./MicroBench --help
+
+QT += core gui openglwidgets
+
+TARGET = MicroBench
+TEMPLATE = app
+CONFIG += console
+CONFIG += c++1z
+CONFIG -= app_bundle
+# Timings of a debug build say little about the game's
+CONFIG -= debug
+CONFIG += release
+
+win32 {
+    LIBS += -lopengl32
+}
+
+SRC = $$PWD/../../src
+
+INCLUDEPATH += $$PWD/../../include \
+    $$SRC \
+    $$SRC/scene
+
+SOURCES += \
+    $$PWD/main.cpp \
+    $$SRC/bufferarena.cpp \
+    $$SRC/drawable.cpp \
+    $$SRC/gpuprofiler.cpp \
+    $$SRC/openglcontext.cpp \
+    $$SRC/shaderprogram.cpp \
+    $$SRC/tracer.cpp \
+    $$SRC/scene/camera.cpp \
+    $$SRC/scene/chunk.cpp \
+    $$SRC/scene/blocksection.cpp \
+    $$SRC/scene/chunkrenderer.cpp \
+    $$SRC/scene/entity.cpp \
+    $$SRC/scene/frustum.cpp \
+    $$SRC/scene/player.cpp \
+    $$SRC/scene/regionfile.cpp \
+    $$SRC/scene/terrain.cpp \
+    $$SRC/scene/terraingenerator.cpp \
+    $$SRC/scene/workerpool.cpp
+
+HEADERS += \
+    $$SRC/scene/chunk.h \
+    $$SRC/scene/blocksection.h \
+    $$SRC/scene/player.h \
+    $$SRC/scene/terrain.h \
+    $$SRC/scene/terraingenerator.h
@@ -0,0 +1,257 @@
+// Generates a grid of terrain generation zones exactly as the game does and
+// reports how fast it went, so generation changes can be measured without
+// opening a window. Run with --help for the options.
+#include "terraingenerator.h"
+#include "regionfile.h"
+#include "workerpool.h"
+#include "smartpointerhelp.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct Options {
+    // The grid is zones x zones terrain generation zones of 4 x 4 Chunks
+    int zones = 4;
+    // World-space corner of the grid
+    int x = 0;
+    int z = 0;
+    // 1 generates every Chunk on the main thread, like CreateProceduralTerrain().
+    // Anything else runs them on a WorkerPool of that many threads, like
+    // requestTerrainZone(), with 0 picking the pool's default.
+    unsigned int threads = 1;
+    // When set, the generated Chunks are also saved to region files in
+    // this directory and loaded back, timing both
+    std::string region;
+};
+
+static void printUsage(const char *program) {
+    std::printf("Usage: %s [--zones N] [--x X] [--z Z] [--threads N] [--region DIR]\n"
+                "  --zones N    generate an N x N grid of 64 x 64 zones (default 4)\n"
+                "  --x X --z Z  world-space corner of the grid (default 0 0)\n"
+                "  --threads N  1 generates on this thread, 0 uses one worker per\n"
+                "               core but one, as the game does (default 1)\n"
+                "  --region DIR save the Chunks to region files in DIR, then time\n"
+                "               loading them back on this thread, both through the\n"
+                "               file stream and from a memory mapping\n",
+                program);
+}
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        if (arg == "--region") {
+            options.region = argv[++i];
+            continue;
+        }
+        int value = std::atoi(argv[++i]);
+        if (arg == "--zones" && value > 0) {
+            options.zones = value;
+        } else if (arg == "--x") {
+            options.x = value;
+        } else if (arg == "--z") {
+            options.z = value;
+        } else if (arg == "--threads" && value >= 0) {
+            options.threads = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Largest resident set size the process has had, in bytes
+static size_t peakMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// FNV-1a over every block, so that an optimization can be checked to
+// generate exactly the same world as before
+static uint64_t hashBlocks(const std::vector<uPtr<Chunk>> &chunks) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const uPtr<Chunk> &chunk : chunks) {
+        for (unsigned int x = 0; x < 16; x++) {
+            for (unsigned int y = 0; y < 256; y++) {
+                for (unsigned int z = 0; z < 16; z++) {
+                    hash ^= chunk->getBlockAt(x, y, z);
+                    hash *= 1099511628211ull;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Taken before the Chunks exist, so that the peak includes their blocks
+    size_t memoryBefore = peakMemoryBytes();
+
+    // Chunks in the order the game would visit them, zone by zone
+    std::vector<uPtr<Chunk>> chunks;
+    for (int zoneZ = 0; zoneZ < options.zones; zoneZ++) {
+        for (int zoneX = 0; zoneX < options.zones; zoneX++) {
+            for (int cx = 0; cx < 64; cx += 16) {
+                for (int cz = 0; cz < 64; cz += 16) {
+                    chunks.push_back(mkU<Chunk>(options.x + 64 * zoneX + cx, options.z + 64 * zoneZ + cz));
+                }
+            }
+        }
+    }
+
+    TerrainGenerator generator;
+    GenerationStats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    if (options.threads == 1) {
+        for (uPtr<Chunk> &chunk : chunks) {
+            generator.generateChunkBlocks(chunk.get(), chunk->getMinX(), chunk->getMinZ(), &stats);
+        }
+    } else {
+        WorkerPool workers(options.threads);
+        options.threads = workers.threadCount();
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = chunks.size();
+        for (uPtr<Chunk> &chunk : chunks) {
+            Chunk *c = chunk.get();
+            workers.enqueue([&, c]() {
+                GenerationStats chunkStats;
+                generator.generateChunkBlocks(c, c->getMinX(), c->getMinZ(), &chunkStats);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                stats += chunkStats;
+                if (--remaining == 0) {
+                    done.notify_one();
+                }
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t memoryAfter = peakMemoryBytes();
+
+    // Stage times are summed over every thread, so with more than one they
+    // add up to more than the wall time
+    double stageTotal = static_cast<double>(stats.biomeNanos + stats.heightNanos + stats.caveNanos + stats.storeNanos);
+    auto printStage = [&](const char *name, int64_t nanos) {
+        std::printf("  %-8s %10.1f ms  %5.1f%%  %8.3f ms/chunk\n", name, nanos / 1e6,
+                    stageTotal > 0 ? 100.0 * nanos / stageTotal : 0.0, nanos / 1e6 / stats.chunks);
+    };
+
+    std::printf("Generated %u chunks (%d x %d zones at %d, %d) on %u thread%s\n", stats.chunks,
+                options.zones, options.zones, options.x, options.z, options.threads,
+                options.threads == 1 ? "" : "s");
+    std::printf("Wall time   %10.1f ms\n", seconds * 1e3);
+    std::printf("Throughput  %10.1f chunks/s\n", stats.chunks / seconds);
+    std::printf("Stages (summed over threads):\n");
+    printStage("height", stats.heightNanos);
+    printStage("biome", stats.biomeNanos);
+    printStage("caves", stats.caveNanos);
+    printStage("store", stats.storeNanos);
+    std::printf("Peak memory %10.1f MiB (%.1f MiB before allocating chunks)\n",
+                memoryAfter / 1048576.0, memoryBefore / 1048576.0);
+    size_t blockBytes = 0;
+    size_t emptySections = 0;
+    size_t singleTypeSections = 0;
+    for (const uPtr<Chunk> &chunk : chunks) {
+        blockBytes += chunk->memoryBytes();
+        for (int s = 0; s < 16; s++) {
+            const BlockSection *section = chunk->getSection(s);
+            if (!section) {
+                emptySections++;
+            } else if (section->isSingleType()) {
+                singleTypeSections++;
+            }
+        }
+    }
+    std::printf("Block memory %9.1f KiB/chunk (%.1f KiB if stored densely)\n",
+                blockBytes / 1024.0 / chunks.size(), 65536 / 1024.0);
+    std::printf("Sections    %9.1f%% empty, %.1f%% one other type, the rest palette-packed\n",
+                100.0 * emptySections / (16 * chunks.size()), 100.0 * singleTypeSections / (16 * chunks.size()));
+    uint64_t hash = hashBlocks(chunks);
+    std::printf("Block hash  %016llx\n", static_cast<unsigned long long>(hash));
+
+    if (options.region.empty()) {
+        return 0;
+    }
+
+    RegionStorage storage(options.region);
+    if (!storage.open()) {
+        std::printf("Could not create %s\n", options.region.c_str());
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    for (const uPtr<Chunk> &chunk : chunks) {
+        if (!storage.saveChunk(*chunk)) {
+            std::printf("Could not save the Chunk at %d, %d\n", chunk->getMinX(), chunk->getMinZ());
+            return 1;
+        }
+    }
+    double saveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t bytes = 0;
+    for (const uPtr<Chunk> &chunk : chunks) {
+        bytes += chunk->serializeBlocks().size();
+    }
+    std::printf("Saved to %s: %.1f ms, %.1f KiB of block data (%.2f KiB/chunk)\n", options.region.c_str(),
+                saveSeconds * 1e3, bytes / 1024.0, bytes / 1024.0 / chunks.size());
+
+    bool match = true;
+    for (RegionReadMode mode : {STREAM_READS, MAPPED_READS}) {
+        // Load into fresh Chunks from a fresh RegionStorage, so nothing is
+        // already open or mapped on this side of the file system
+        std::vector<uPtr<Chunk>> loaded;
+        RegionStorage reopened(options.region, mode);
+        start = std::chrono::steady_clock::now();
+        for (const uPtr<Chunk> &chunk : chunks) {
+            loaded.push_back(mkU<Chunk>(chunk->getMinX(), chunk->getMinZ()));
+            if (!reopened.loadChunk(loaded.back().get())) {
+                std::printf("Could not load the Chunk at %d, %d\n", chunk->getMinX(), chunk->getMinZ());
+                return 1;
+            }
+        }
+        double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        bool modeMatch = hashBlocks(loaded) == hash;
+        match = match && modeMatch;
+        std::printf("Loaded back (%s) %8.1f ms  %8.3f ms/chunk  %s\n", mode == MAPPED_READS ? "mapped" : "stream",
+                    loadSeconds * 1e3, loadSeconds * 1e3 / chunks.size(), modeMatch ? "blocks match" : "BLOCKS DIFFER");
+    }
+    return match ? 0 : 1;
+}
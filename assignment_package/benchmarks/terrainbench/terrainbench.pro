@@ -0,0 +1,41 @@
+# Headless terrain generation benchmark. Links only the block generation,
+# Chunk, region file and worker pool code, so it needs no window, widget or GL context.
+#   qmake terrainbench.pro && make && ./TerrainBench --help
+
+QT -= gui
+
+TARGET = TerrainBench
+TEMPLATE = app
+CONFIG += console
+CONFIG += c++1z
+CONFIG -= app_bundle
+# Timings of a debug build say little about the game's
+CONFIG -= debug
+CONFIG += release
+
+SRC = $$PWD/../../src
+
+INCLUDEPATH += $$PWD/../../include \
+    $$SRC \
+    $$SRC/scene
+
+SOURCES += \
+    $$PWD/main.cpp \
+    $$SRC/scene/terraingenerator.cpp \
+    $$SRC/scene/chunk.cpp \
+    $$SRC/scene/blocksection.cpp \
+    $$SRC/scene/regionfile.cpp \
+    $$SRC/scene/workerpool.cpp \
+    $$SRC/tracer.cpp
+
+HEADERS += \
+    $$SRC/scene/terraingenerator.h \
+    $$SRC/scene/chunk.h \
+    $$SRC/scene/blocksection.h \
+    $$SRC/scene/regionfile.h \
+    $$SRC/scene/workerpool.h \
+    $$SRC/tracer.h
+
+win32 {
+    LIBS += -lpsapi
+}
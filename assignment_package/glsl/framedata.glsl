@@ -0,0 +1,9 @@
+// Per-frame values shared by every shader program. Filled once per frame
+// by FrameUniforms (see frameuniforms.h) and must match its layout.
+// Pasted in by ShaderProgram wherever a shader has #include "framedata.glsl".
+layout(std140) uniform FrameData {
+    mat4 u_ViewProj;        // The camera's combined projection and view matrices
+    mat4 u_InvViewProj;     // Its inverse, for turning screen positions back into world rays
+    vec3 u_SunDir;          // Direction towards the sun
+    int u_Time;             // Fixed 1/60 s simulation steps so far (not frames), for animations
+};
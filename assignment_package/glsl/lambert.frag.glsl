@@ -13,8 +13,7 @@
 
 uniform vec4 u_Color; // The color with which to render this instance of geometry.
 uniform sampler2D u_Texture;
-uniform int u_Time;
-uniform vec3 u_SunDir;
+#include "framedata.glsl"
 
 // These are the interpolated values out of the rasterizer, so you can't know
 // their specific values without knowing the vertices that contributed to them
@@ -78,7 +77,12 @@ void main()
     vec4 baseColor = fs_Col;
     baseColor = baseColor * (0.5 * fbm(fs_Pos.xyz) + 0.5);
 
-    vec2 sampleUV = fs_UV.xy;
+    // fs_UV.xy counts blocks across the (possibly merged) face and fs_UV.z
+    // is the block's tile in the 16x16 texture atlas, so wrap the UVs back
+    // into that tile to repeat its texture once per block.
+    float tileIdx = floor(fs_UV.z + 0.5);
+    vec2 tile = vec2(mod(tileIdx, 16.0), floor(tileIdx / 16.0));
+    vec2 sampleUV = (tile + fract(fs_UV.xy)) / 16.0;
 
     if (fs_UV.w == 1) {
         int rate = 4;
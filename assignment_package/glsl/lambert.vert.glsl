@@ -8,29 +8,24 @@
 //This simultaneous transformation allows your program to run much faster, especially when rendering
 //geometry with millions of vertices.
 
-uniform mat4 u_Model;       // The matrix that defines the transformation of the
-                            // object we're rendering. In this assignment,
-                            // this will be the result of traversing your scene graph.
-
-uniform mat4 u_ModelInvTr;  // The inverse transpose of the model matrix.
-                            // This allows us to transform the object's normals properly
-                            // if the object has been non-uniformly scaled.
-
-uniform mat4 u_ViewProj;    // The matrix that defines the camera's transformation.
-                            // We've written a static matrix for you to use for HW2,
-                            // but in HW3 you'll have to generate one yourself
+#include "framedata.glsl"
 
 uniform vec4 u_Color;       // When drawing the cube instance, we'll set our uniform color to represent different block types.
 
-in vec4 vs_Pos;             // The array of vertex positions passed to the shader
+uniform vec4 u_BlockColors[16]; // The color of each BlockType, indexed by its value
 
-in vec4 vs_Nor;             // The array of vertex normals passed to the shader
+in uvec2 vs_Packed;         // One packed Chunk vertex. See ChunkVertex in chunk.h for the bit layout.
+in vec4 vs_ChunkOrigin;     // The world-space corner of the Chunk this vertex belongs to.
+                            // Supplied once per draw (as instance data) by ChunkRenderer,
+                            // in place of a model matrix.
 
-in vec4 vs_Col;             // The array of vertex colors passed to the shader.
-in vec4 vs_UV;
+// The normal of each Direction, in the order the Direction enum declares them
+const vec4 faceNormals[6] = vec4[6](vec4(1, 0, 0, 0), vec4(-1, 0, 0, 0),
+                                    vec4(0, 1, 0, 0), vec4(0, -1, 0, 0),
+                                    vec4(0, 0, 1, 0), vec4(0, 0, -1, 0));
 
 out vec4 fs_Pos;
-out vec4 fs_Nor;            // The array of normals that has been transformed by u_ModelInvTr. This is implicitly passed to the fragment shader.
+out vec4 fs_Nor;            // The array of normals. This is implicitly passed to the fragment shader.
 out vec4 fs_LightVec;       // The direction in which our virtual light lies, relative to each vertex. This is implicitly passed to the fragment shader.
 out vec4 fs_Col;            // The color of each vertex. This is implicitly passed to the fragment shader.
 out vec4 fs_UV;
@@ -39,19 +34,25 @@ const vec4 lightDir = normalize(vec4(0.5, 1, 0.75, 0));  // The direction of our
 
 void main()
 {
-    fs_Pos = vs_Pos;
-    fs_Col = vs_Col;                         // Pass the vertex colors to the fragment shader for interpolation
-    fs_UV = vs_UV;
+    // Unpack the vertex
+    uint posBits = vs_Packed.x;
+    uint texBits = vs_Packed.y;
+    vec4 vs_Pos = vec4(float(posBits & 31u),
+                       float((posBits >> 5) & 511u),
+                       float((posBits >> 14) & 31u), 1);
+    vec4 vs_Nor = faceNormals[(posBits >> 19) & 7u];
+    int blockType = int((posBits >> 22) & 255u);
 
-    mat3 invTranspose = mat3(u_ModelInvTr);
-    fs_Nor = vec4(invTranspose * vec3(vs_Nor), 0);          // Pass the vertex normals to the fragment shader for interpolation.
-                                                            // Transform the geometry's normals by the inverse transpose of the
-                                                            // model matrix. This is necessary to ensure the normals remain
-                                                            // perpendicular to the surface after the surface is transformed by
-                                                            // the model matrix.
+    fs_Pos = vs_Pos;
+    fs_Col = u_BlockColors[blockType];       // Pass the vertex colors to the fragment shader for interpolation
+    fs_UV = vec4(float(texBits & 511u),
+                 float((texBits >> 9) & 511u),
+                 float((texBits >> 18) & 255u),
+                 float((texBits >> 26) & 1u));
 
+    fs_Nor = vs_Nor;            // Chunks are only ever translated, so their normals need no transformation
 
-    vec4 modelposition = u_Model * vs_Pos;   // Temporarily store the transformed vertex positions for use below
+    vec4 modelposition = vs_Pos + vec4(vs_ChunkOrigin.xyz, 0);   // Temporarily store the transformed vertex positions for use below
 
     fs_LightVec = (lightDir);  // Compute the direction in which the light source lies
 
@@ -1,6 +1,6 @@
 #version 150
 
-uniform int u_Time;
+#include "framedata.glsl"
 
 in vec2 fs_UV;
 
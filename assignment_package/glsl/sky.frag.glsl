@@ -1,8 +1,6 @@
 #version 150
 
-uniform mat4 u_ViewProj;   // We're actually passing the inverse of the viewproj
-                           // from our CPU, but it's named u_ViewProj so we don't
-                           // have to bother rewriting our ShaderProgram class
+#include "framedata.glsl"
 
 uniform ivec2 u_Dimensions; // Screen dimensions
 
@@ -244,7 +242,7 @@ void main()
 
    vec4 p = vec4(ndc.xy, 1, 1); // Pixel at the far clip plane
    p *= 1000.0; // Times far clip plane value
-   p = /*Inverse of*/ u_ViewProj * p; // Convert from unhomogenized screen to world
+   p = u_InvViewProj * p; // Convert from unhomogenized screen to world
 
 
    // Get the ray direction of the fragment
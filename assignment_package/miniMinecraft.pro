@@ -12,6 +12,14 @@ win32 {
 CONFIG += warn_on
 CONFIG += debug
 
+# Compiles in GL error checking and KHR_debug output (see openglcontext.h).
+# Off unless asked for with `qmake CONFIG+=gl_debug`, so that ordinary
+# builds never create a debug context or poll glGetError.
+gl_debug {
+    message("Enabling OpenGL debug output")
+    DEFINES += DEBUG_GL
+}
+
 INCLUDEPATH += include
 
 include(src/src.pri)
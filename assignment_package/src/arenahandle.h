@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+
+// Identifies one range allocated from a BufferArena. The range may move
+// when the arena grows or compacts, so its offset is looked up through
+// the handle whenever it is needed rather than stored.
+// Kept apart from bufferarena.h so that code holding handles, like Chunk,
+// doesn't need the GL headers.
+typedef uint32_t ArenaHandle;
+static const ArenaHandle INVALID_ARENA_HANDLE = 0;
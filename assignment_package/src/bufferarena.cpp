@@ -0,0 +1,223 @@
+#include "bufferarena.h"
+#include <algorithm>
+#include <iterator>
+
+float ArenaStats::fragmentation() const
+{
+    if (freeBytes == 0) {
+        return 0.f;
+    }
+    return 1.f - static_cast<float>(largestFreeRange) / freeBytes;
+}
+
+BufferArena::BufferArena(OpenGLContext* context, size_t alignment, const std::string &label)
+    : m_buffer(), m_created(false), m_capacity(0), m_alignment(alignment), m_freeRanges(),
+      m_ranges(1, Range{0, 0, false}), m_freeHandles(), m_generation(0), m_stats(), m_label(label),
+      mp_context(context)
+{}
+
+void BufferArena::create(size_t initialCapacity)
+{
+    if (m_created) {
+        return;
+    }
+    reallocate(align(initialCapacity));
+}
+
+void BufferArena::destroy()
+{
+    if (m_created) {
+        mp_context->glDeleteBuffers(1, &m_buffer);
+        m_created = false;
+        m_generation++;
+    }
+    m_capacity = 0;
+    m_freeRanges.clear();
+    m_ranges.assign(1, Range{0, 0, false});
+    m_freeHandles.clear();
+    m_stats = ArenaStats();
+}
+
+size_t BufferArena::align(size_t bytes) const
+{
+    return (bytes + m_alignment - 1) / m_alignment * m_alignment;
+}
+
+ArenaHandle BufferArena::allocate(size_t bytes)
+{
+    bytes = align(bytes);
+
+    size_t offset = 0;
+    if (bytes > 0 && !takeFreeRange(bytes, offset)) {
+        // Compacting only pays off if it leaves some headroom afterwards;
+        // when the buffer would still be more than 3/4 full, grow instead
+        // so that the next few allocations don't land back here.
+        if (4 * (m_stats.usedBytes + bytes) <= 3 * m_capacity) {
+            reallocate(m_capacity);
+            m_stats.compactions++;
+        } else {
+            reallocate(align(std::max(2 * m_capacity, m_stats.usedBytes + bytes)));
+            m_stats.growths++;
+        }
+        takeFreeRange(bytes, offset);
+    }
+
+    ArenaHandle handle;
+    if (!m_freeHandles.empty()) {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    } else {
+        handle = m_ranges.size();
+        m_ranges.push_back(Range());
+    }
+    m_ranges[handle] = Range{offset, bytes, true};
+
+    m_stats.usedBytes += bytes;
+    m_stats.allocations++;
+    return handle;
+}
+
+void BufferArena::release(ArenaHandle handle)
+{
+    if (handle == INVALID_ARENA_HANDLE || handle >= m_ranges.size() || !m_ranges[handle].live) {
+        return;
+    }
+    Range &range = m_ranges[handle];
+    if (range.bytes > 0) {
+        returnFreeRange(range.offset, range.bytes);
+    }
+    m_stats.usedBytes -= range.bytes;
+    m_stats.allocations--;
+    range.live = false;
+    m_freeHandles.push_back(handle);
+}
+
+void BufferArena::write(ArenaHandle handle, size_t offset, const void *data, size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+    // Bound to a copy target so that whichever VAO is current keeps its
+    // element array buffer
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    mp_context->glBufferSubData(GL_COPY_WRITE_BUFFER, m_ranges[handle].offset + offset, bytes, data);
+}
+
+void BufferArena::compact()
+{
+    if (m_created && m_freeRanges.size() > 1) {
+        reallocate(m_capacity);
+        m_stats.compactions++;
+    }
+}
+
+bool BufferArena::takeFreeRange(size_t bytes, size_t &offset)
+{
+    auto fit = std::find_if(m_freeRanges.begin(), m_freeRanges.end(),
+                            [bytes](const std::pair<const size_t, size_t> &range) {
+                                return range.second >= bytes;
+                            });
+    if (fit == m_freeRanges.end()) {
+        return false;
+    }
+
+    offset = fit->first;
+    size_t remaining = fit->second - bytes;
+    m_freeRanges.erase(fit);
+    if (remaining > 0) {
+        m_freeRanges[offset + bytes] = remaining;
+    }
+    return true;
+}
+
+void BufferArena::returnFreeRange(size_t offset, size_t bytes)
+{
+    auto it = m_freeRanges.emplace(offset, bytes).first;
+
+    // Merge with the free range just after this one
+    auto next = std::next(it);
+    if (next != m_freeRanges.end() && it->first + it->second == next->first) {
+        it->second += next->second;
+        m_freeRanges.erase(next);
+    }
+    // And the one just before it
+    if (it != m_freeRanges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == it->first) {
+            prev->second += it->second;
+            m_freeRanges.erase(it);
+        }
+    }
+}
+
+void BufferArena::reallocate(size_t newCapacity)
+{
+    GLuint newBuffer;
+    mp_context->glGenBuffers(1, &newBuffer);
+    mp_context->glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    mp_context->glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_DYNAMIC_DRAW);
+    mp_context->labelObject(GL_BUFFER, newBuffer, m_label);
+
+    size_t packedEnd = 0;
+    if (m_created) {
+        // Copy the live ranges over in offset order, so that packing them
+        // together keeps their relative order
+        std::vector<ArenaHandle> live;
+        for (ArenaHandle h = 1; h < m_ranges.size(); h++) {
+            if (m_ranges[h].live && m_ranges[h].bytes > 0) {
+                live.push_back(h);
+            }
+        }
+        std::sort(live.begin(), live.end(), [this](ArenaHandle a, ArenaHandle b) {
+            return m_ranges[a].offset < m_ranges[b].offset;
+        });
+
+        mp_context->glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+        for (ArenaHandle h : live) {
+            Range &range = m_ranges[h];
+            mp_context->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                            range.offset, packedEnd, range.bytes);
+            range.offset = packedEnd;
+            packedEnd += range.bytes;
+        }
+        mp_context->glDeleteBuffers(1, &m_buffer);
+    }
+
+    m_buffer = newBuffer;
+    m_created = true;
+    m_capacity = newCapacity;
+    m_generation++;
+    m_freeRanges.clear();
+    if (packedEnd < m_capacity) {
+        m_freeRanges[packedEnd] = m_capacity - packedEnd;
+    }
+}
+
+size_t BufferArena::offsetOf(ArenaHandle handle) const
+{
+    return m_ranges[handle].offset;
+}
+
+GLuint BufferArena::buffer() const
+{
+    return m_buffer;
+}
+
+unsigned int BufferArena::generation() const
+{
+    return m_generation;
+}
+
+ArenaStats BufferArena::stats() const
+{
+    ArenaStats stats = m_stats;
+    stats.capacity = m_capacity;
+    stats.freeBytes = 0;
+    stats.largestFreeRange = 0;
+    stats.freeRanges = m_freeRanges.size();
+    for (const auto &range : m_freeRanges) {
+        stats.freeBytes += range.second;
+        stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+    }
+    return stats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <openglcontext.h>
+#include "arenahandle.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// How full and how fragmented a BufferArena is
+struct ArenaStats {
+    size_t capacity = 0;
+    size_t usedBytes = 0;
+    size_t freeBytes = 0;
+    // The biggest allocation that would currently fit without growing or compacting
+    size_t largestFreeRange = 0;
+    unsigned int allocations = 0;
+    unsigned int freeRanges = 0;
+    // How many times the buffer has been reallocated to grow or compact it
+    unsigned int growths = 0;
+    unsigned int compactions = 0;
+
+    // 0 when all free space is one range, approaching 1 as it splinters
+    float fragmentation() const;
+};
+
+// A single GL buffer that many meshes share, handing out byte ranges of it
+// so they can all be drawn by one multi-draw call without rebinding.
+// Free space is kept in a first-fit free list that merges neighboring
+// ranges when they are released. When no free range is big enough, the
+// arena compacts, packing every live range to the front of a fresh buffer,
+// as long as that leaves it at most 3/4 full. Otherwise it doubles. Both
+// copy the contents over on the GPU and change buffer(), so callers must
+// check generation() and re-point anything bound to the old buffer.
+class BufferArena {
+private:
+    // Where a handle's range currently lives
+    struct Range {
+        size_t offset;
+        size_t bytes;
+        bool live;
+    };
+
+    GLuint m_buffer;
+    bool m_created;
+    size_t m_capacity;
+    // Every range is rounded up to a multiple of this many bytes
+    size_t m_alignment;
+    // Unused ranges of the buffer, offset -> size
+    std::map<size_t, size_t> m_freeRanges;
+    // Indexed by ArenaHandle; entry 0 is never used
+    std::vector<Range> m_ranges;
+    // Handles of released ranges, to be reused by allocate()
+    std::vector<ArenaHandle> m_freeHandles;
+    unsigned int m_generation;
+    ArenaStats m_stats;
+    // Names the buffer in GL debug output
+    std::string m_label;
+
+    OpenGLContext* mp_context;
+
+    // Replaces the buffer with one of newCapacity bytes, copying every
+    // live range into it packed together at the front
+    void reallocate(size_t newCapacity);
+    size_t align(size_t bytes) const;
+    // Takes bytes out of the free list, or returns false if no range fits
+    bool takeFreeRange(size_t bytes, size_t &offset);
+    void returnFreeRange(size_t offset, size_t bytes);
+
+public:
+    BufferArena(OpenGLContext* context, size_t alignment, const std::string &label);
+
+    // Allocates the buffer with room for initialCapacity bytes. GL thread only.
+    void create(size_t initialCapacity);
+    // Deletes the buffer and invalidates every handle. GL thread only.
+    void destroy();
+
+    // Returns a handle to a new range of at least bytes bytes, compacting
+    // or growing the buffer if no free range is big enough
+    ArenaHandle allocate(size_t bytes);
+    // Returns a handle's range to the free list
+    void release(ArenaHandle handle);
+    // Copies bytes of data into a handle's range, starting offset bytes into it
+    void write(ArenaHandle handle, size_t offset, const void *data, size_t bytes);
+    // Packs every live range to the front of the buffer, leaving all the
+    // free space in one range at the end
+    void compact();
+
+    // Where a handle's range currently starts in the buffer
+    size_t offsetOf(ArenaHandle handle) const;
+
+    GLuint buffer() const;
+    // Changes every time buffer() is replaced by a grown or compacted one
+    unsigned int generation() const;
+    ArenaStats stats() const;
+};
@@ -1,9 +1,11 @@
 #include "drawable.h"
 #include <glm_includes.h>
 
+int Drawable::s_liveBuffers = 0;
+
 Drawable::Drawable(OpenGLContext* context)
-    : m_count(-1), m_bufIdx(), m_bufPos(), m_bufNor(), m_bufCol(), m_bufUV(), m_bufVBO(), m_bufTpVBO(),
-      m_idxGenerated(false), m_posGenerated(false), m_norGenerated(false), m_colGenerated(false),
+    : m_count(-1), m_tpCount(-1), m_bufIdx(), m_bufTpIdx(), m_bufPos(), m_bufNor(), m_bufCol(), m_bufUV(), m_bufVBO(), m_bufTpVBO(),
+      m_idxGenerated(false), m_tpIdxGenerated(false), m_posGenerated(false), m_norGenerated(false), m_colGenerated(false),
       m_UVGenerated(false), m_VBOGenerated(false), m_tpVBOGenerated(false),
       mp_context(context)
 {}
@@ -14,16 +16,39 @@ Drawable::~Drawable()
 
 void Drawable::destroyVBOdata()
 {
-    mp_context->glDeleteBuffers(1, &m_bufIdx);
-    mp_context->glDeleteBuffers(1, &m_bufTpIdx);
-    mp_context->glDeleteBuffers(1, &m_bufPos);
-    mp_context->glDeleteBuffers(1, &m_bufNor);
-    mp_context->glDeleteBuffers(1, &m_bufCol);
-    mp_context->glDeleteBuffers(1, &m_bufUV);
-    mp_context->glDeleteBuffers(1, &m_bufVBO);
-    mp_context->glDeleteBuffers(1, &m_bufTpVBO);
-    m_idxGenerated = m_posGenerated = m_norGenerated = m_colGenerated = m_UVGenerated = false;
+    releaseBuffer(m_bufIdx, m_idxGenerated);
+    releaseBuffer(m_bufTpIdx, m_tpIdxGenerated);
+    releaseBuffer(m_bufPos, m_posGenerated);
+    releaseBuffer(m_bufNor, m_norGenerated);
+    releaseBuffer(m_bufCol, m_colGenerated);
+    releaseBuffer(m_bufUV, m_UVGenerated);
+    releaseBuffer(m_bufVBO, m_VBOGenerated);
+    releaseBuffer(m_bufTpVBO, m_tpVBOGenerated);
     m_count = -1;
+    m_tpCount = -1;
+}
+
+int Drawable::liveBufferCount()
+{
+    return s_liveBuffers;
+}
+
+void Drawable::generateBuffer(GLuint &buf, bool &generated)
+{
+    if (!generated) {
+        mp_context->glGenBuffers(1, &buf);
+        generated = true;
+        s_liveBuffers++;
+    }
+}
+
+void Drawable::releaseBuffer(GLuint &buf, bool &generated)
+{
+    if (generated) {
+        mp_context->glDeleteBuffers(1, &buf);
+        generated = false;
+        s_liveBuffers--;
+    }
 }
 
 GLenum Drawable::drawMode()
@@ -49,54 +74,46 @@ int Drawable::tpElemCount()
 
 void Drawable::generateIdx()
 {
-    m_idxGenerated = true;
     // Create a VBO on our GPU and store its handle in bufIdx
-    mp_context->glGenBuffers(1, &m_bufIdx);
+    generateBuffer(m_bufIdx, m_idxGenerated);
 }
 
 void Drawable::generateTpIdx()
 {
-    m_tpIdxGenerated = true;
-    // Create a VBO on our GPU and store its handle in bufIdx
-    mp_context->glGenBuffers(1, &m_bufTpIdx);
+    // Create a VBO on our GPU and store its handle in bufTpIdx
+    generateBuffer(m_bufTpIdx, m_tpIdxGenerated);
 }
 
 void Drawable::generatePos()
 {
-    m_posGenerated = true;
     // Create a VBO on our GPU and store its handle in bufPos
-    mp_context->glGenBuffers(1, &m_bufPos);
+    generateBuffer(m_bufPos, m_posGenerated);
 }
 
 void Drawable::generateNor()
 {
-    m_norGenerated = true;
     // Create a VBO on our GPU and store its handle in bufNor
-    mp_context->glGenBuffers(1, &m_bufNor);
+    generateBuffer(m_bufNor, m_norGenerated);
 }
 
 void Drawable::generateCol()
 {
-    m_colGenerated = true;
     // Create a VBO on our GPU and store its handle in bufCol
-    mp_context->glGenBuffers(1, &m_bufCol);
+    generateBuffer(m_bufCol, m_colGenerated);
 }
 
 void Drawable::generateUV()
 {
-    m_UVGenerated = true;
     // Create a VBO on our GPU and store its handle in bufUV
-    mp_context->glGenBuffers(1, &m_bufUV);
+    generateBuffer(m_bufUV, m_UVGenerated);
 }
 
 void Drawable::generateVBO() {
-    m_VBOGenerated = true;
-    mp_context->glGenBuffers(1, &m_bufVBO);
+    generateBuffer(m_bufVBO, m_VBOGenerated);
 }
 
 void Drawable::generateTpVBO() {
-    m_tpVBOGenerated = true;
-    mp_context->glGenBuffers(1, &m_bufTpVBO);
+    generateBuffer(m_bufTpVBO, m_tpVBOGenerated);
 }
 
 bool Drawable::bindIdx()
@@ -143,6 +160,7 @@ bool Drawable::bindUV() {
     if(m_UVGenerated){
         mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufUV);
     }
+    return m_UVGenerated;
 }
 
 bool Drawable::bindVBO()
@@ -172,8 +190,7 @@ int InstancedDrawable::instanceCount() const {
 }
 
 void InstancedDrawable::generateOffsetBuf() {
-    m_offsetGenerated = true;
-    mp_context->glGenBuffers(1, &m_bufPosOffset);
+    generateBuffer(m_bufPosOffset, m_offsetGenerated);
 }
 
 bool InstancedDrawable::bindOffsetBuf() {
@@ -185,14 +202,8 @@ bool InstancedDrawable::bindOffsetBuf() {
 
 
 void InstancedDrawable::clearOffsetBuf() {
-    if(m_offsetGenerated) {
-        mp_context->glDeleteBuffers(1, &m_bufPosOffset);
-        m_offsetGenerated = false;
-    }
+    releaseBuffer(m_bufPosOffset, m_offsetGenerated);
 }
 void InstancedDrawable::clearColorBuf() {
-    if(m_colGenerated) {
-        mp_context->glDeleteBuffers(1, &m_bufCol);
-        m_colGenerated = false;
-    }
+    releaseBuffer(m_bufCol, m_colGenerated);
 }
@@ -29,10 +29,18 @@ protected:
     bool m_VBOGenerated;
     bool m_tpVBOGenerated;
 
+    // Total across every Drawable, for checking that buffers aren't leaked
+    static int s_liveBuffers;
+
     OpenGLContext* mp_context; // Since Qt's OpenGL support is done through classes like QOpenGLFunctions_3_2_Core,
                           // we need to pass our OpenGL context to the Drawable in order to call GL functions
                           // from within this class.
 
+    // Calls glGenBuffers for buf unless it already exists
+    void generateBuffer(GLuint &buf, bool &generated);
+    // Calls glDeleteBuffers on buf if it exists
+    void releaseBuffer(GLuint &buf, bool &generated);
+
 
 public:
     Drawable(OpenGLContext* mp_context);
@@ -41,6 +49,9 @@ public:
     virtual void createVBOdata() = 0; // To be implemented by subclasses. Populates the VBOs of the Drawable.
     void destroyVBOdata(); // Frees the VBOs of the Drawable.
 
+    // The number of GL buffers that currently exist across all Drawables
+    static int liveBufferCount();
+
     // Getter functions for various GL data
     virtual GLenum drawMode();
     int elemCount();
@@ -48,6 +59,7 @@ public:
 
     // Call these functions when you want to call glGenBuffers on the buffers stored in the Drawable
     // These will properly set the values of idxBound etc. which need to be checked in ShaderProgram::draw()
+    // Calling one again reuses the existing buffer rather than generating another
     void generateIdx();
     void generateTpIdx();
     void generatePos();
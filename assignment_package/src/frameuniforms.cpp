@@ -0,0 +1,32 @@
+#include "frameuniforms.h"
+
+FrameUniforms::FrameUniforms(OpenGLContext* context)
+    : m_buffer(), m_created(false), mp_context(context)
+{}
+
+void FrameUniforms::create()
+{
+    if (m_created) {
+        return;
+    }
+    mp_context->glGenBuffers(1, &m_buffer);
+    mp_context->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    mp_context->glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+    mp_context->labelObject(GL_BUFFER, m_buffer, "Frame uniforms");
+    mp_context->glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, m_buffer);
+    m_created = true;
+}
+
+void FrameUniforms::destroy()
+{
+    if (m_created) {
+        mp_context->glDeleteBuffers(1, &m_buffer);
+        m_created = false;
+    }
+}
+
+void FrameUniforms::update(const FrameData &data)
+{
+    mp_context->glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    mp_context->glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <openglcontext.h>
+#include <glm_includes.h>
+
+// The values every shader program needs once per frame, laid out to match
+// the std140 FrameData uniform block in glsl/framedata.glsl
+struct FrameData {
+    glm::mat4 viewProj;
+    glm::mat4 invViewProj;
+    glm::vec3 sunDir;
+    GLint time;
+};
+static_assert(sizeof(FrameData) == 144, "FrameData must match the std140 layout of the FrameData block");
+
+// A uniform buffer holding this frame's FrameData. It stays bound to
+// FRAME_DATA_BINDING, and ShaderProgram::create() points every program's
+// FrameData block at that binding, so one upload per frame reaches all of
+// them without setting any uniforms per program.
+class FrameUniforms {
+private:
+    GLuint m_buffer;
+    bool m_created;
+
+    OpenGLContext* mp_context;
+
+public:
+    // The uniform buffer binding point the FrameData block is read from
+    static const GLuint FRAME_DATA_BINDING = 0;
+
+    FrameUniforms(OpenGLContext* context);
+
+    // GL thread only
+    void create();
+    void destroy();
+    // Replaces the buffer's contents with this frame's values
+    void update(const FrameData &data);
+};
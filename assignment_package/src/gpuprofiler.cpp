@@ -0,0 +1,151 @@
+#include "gpuprofiler.h"
+#include <algorithm>
+#include <vector>
+
+GpuProfiler::GpuProfiler(OpenGLContext* context)
+    : m_queries(), m_pending(), m_frame(0), m_timing(false), m_created(false), m_supported(false),
+      m_history(), mp_context(context)
+{}
+
+void GpuProfiler::create()
+{
+    if (m_created) {
+        return;
+    }
+    QOpenGLContext *ctx = mp_context->context();
+    QSurfaceFormat format = ctx->format();
+    m_supported = format.majorVersion() > 3 || (format.majorVersion() == 3 && format.minorVersion() >= 3) ||
+                  ctx->hasExtension("GL_ARB_timer_query");
+    if (!m_supported) {
+        return;
+    }
+
+    for (auto &frame : m_queries) {
+        mp_context->glGenQueries(NUM_GPU_PASSES, frame.data());
+    }
+    for (auto &frame : m_pending) {
+        frame.fill(false);
+    }
+    m_created = true;
+}
+
+void GpuProfiler::destroy()
+{
+    if (m_created) {
+        for (auto &frame : m_queries) {
+            mp_context->glDeleteQueries(NUM_GPU_PASSES, frame.data());
+        }
+        m_created = false;
+    }
+}
+
+void GpuProfiler::beginFrame()
+{
+    if (!m_created) {
+        return;
+    }
+    m_frame = (m_frame + 1) % FRAMES_IN_FLIGHT;
+
+    for (int pass = 0; pass < NUM_GPU_PASSES; pass++) {
+        if (!m_pending[m_frame][pass]) {
+            continue;
+        }
+        m_pending[m_frame][pass] = false;
+
+        // Still not done after FRAMES_IN_FLIGHT frames: drop the sample
+        // rather than stall, and reuse the query
+        GLuint query = m_queries[m_frame][pass];
+        GLuint available = 0;
+        mp_context->glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        // In nanoseconds. 32 bits covers passes of up to four seconds.
+        GLuint elapsed = 0;
+        mp_context->glGetQueryObjectuiv(query, GL_QUERY_RESULT, &elapsed);
+
+        std::deque<float> &history = m_history[pass];
+        history.push_back(elapsed / 1e6f);
+        if (history.size() > HISTORY_FRAMES) {
+            history.pop_front();
+        }
+    }
+}
+
+void GpuProfiler::begin(GpuPass pass)
+{
+    if (!m_created || m_timing) {
+        return;
+    }
+    mp_context->glBeginQuery(GL_TIME_ELAPSED, m_queries[m_frame][pass]);
+    m_pending[m_frame][pass] = true;
+    m_timing = true;
+}
+
+void GpuProfiler::end()
+{
+    if (!m_timing) {
+        return;
+    }
+    mp_context->glEndQuery(GL_TIME_ELAPSED);
+    m_timing = false;
+}
+
+PassTimings GpuProfiler::timings(GpuPass pass) const
+{
+    PassTimings timings;
+    const std::deque<float> &history = m_history[pass];
+    if (history.empty()) {
+        return timings;
+    }
+
+    std::vector<float> sorted(history.begin(), history.end());
+    std::sort(sorted.begin(), sorted.end());
+    float total = 0.f;
+    for (float ms : sorted) {
+        total += ms;
+    }
+
+    timings.samples = sorted.size();
+    timings.average = total / sorted.size();
+    timings.median = sorted[sorted.size() / 2];
+    timings.p95 = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+    timings.max = sorted.back();
+    return timings;
+}
+
+bool GpuProfiler::isSupported() const
+{
+    return m_supported;
+}
+
+const char* GpuProfiler::passName(GpuPass pass)
+{
+    switch (pass) {
+    case SKY_PASS:
+        return "sky";
+    case OPAQUE_PASS:
+        return "opaque";
+    case TRANSPARENT_PASS:
+        return "transparent";
+    case POST_PROCESS_PASS:
+        return "post";
+    default:
+        return "?";
+    }
+}
+
+GpuProfiler::Scope::Scope(GpuProfiler *profiler, GpuPass pass)
+    : mp_profiler(profiler)
+{
+    if (mp_profiler) {
+        mp_profiler->begin(pass);
+    }
+}
+
+GpuProfiler::Scope::~Scope()
+{
+    if (mp_profiler) {
+        mp_profiler->end();
+    }
+}
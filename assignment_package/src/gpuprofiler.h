@@ -0,0 +1,75 @@
+#pragma once
+#include <openglcontext.h>
+#include <array>
+#include <deque>
+
+// The render passes that GpuProfiler times, in the order they run each frame
+enum GpuPass : unsigned char {
+    SKY_PASS, OPAQUE_PASS, TRANSPARENT_PASS, POST_PROCESS_PASS, NUM_GPU_PASSES
+};
+
+// Rolling GPU times of one pass, in milliseconds
+struct PassTimings {
+    float average = 0.f;
+    float median = 0.f;
+    float p95 = 0.f;
+    float max = 0.f;
+    // How many frames these were computed from
+    unsigned int samples = 0;
+};
+
+// Measures how long the GPU spends on each GpuPass using GL_TIME_ELAPSED
+// queries. Each frame's queries come from a ring of FRAMES_IN_FLIGHT sets,
+// and a set's results are only read back once the ring comes around to it
+// again and GL says they are available, so the CPU never waits on the GPU.
+// Needs GL 3.3 or ARB_timer_query (which llvmpipe also provides);
+// everything is a no-op without it.
+class GpuProfiler {
+private:
+    static const int FRAMES_IN_FLIGHT = 4;
+    // How many frames of each pass's times the statistics cover
+    static const size_t HISTORY_FRAMES = 240;
+
+    std::array<std::array<GLuint, NUM_GPU_PASSES>, FRAMES_IN_FLIGHT> m_queries;
+    // Whether each query was issued and its result not yet read
+    std::array<std::array<bool, NUM_GPU_PASSES>, FRAMES_IN_FLIGHT> m_pending;
+    // The ring slot used by the current frame
+    int m_frame;
+    // Only one GL_TIME_ELAPSED query may be active at a time
+    bool m_timing;
+    bool m_created;
+    bool m_supported;
+    std::array<std::deque<float>, NUM_GPU_PASSES> m_history;
+
+    OpenGLContext* mp_context;
+
+public:
+    GpuProfiler(OpenGLContext* context);
+
+    // GL thread only
+    void create();
+    void destroy();
+
+    // Moves on to the next ring slot, first collecting that slot's results
+    // from FRAMES_IN_FLIGHT frames ago. Call once at the start of each frame.
+    void beginFrame();
+    // Brackets the GL commands of one pass. Passes must not overlap.
+    void begin(GpuPass pass);
+    void end();
+
+    PassTimings timings(GpuPass pass) const;
+    bool isSupported() const;
+    static const char* passName(GpuPass pass);
+
+    // Times a pass for as long as it is in scope. Does nothing if the
+    // profiler is null, so callers can make profiling optional.
+    class Scope {
+    private:
+        GpuProfiler *mp_profiler;
+    public:
+        Scope(GpuProfiler *profiler, GpuPass pass);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
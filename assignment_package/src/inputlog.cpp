@@ -0,0 +1,90 @@
+#include "inputlog.h"
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+static const char *LOG_HEADER = "mini-minecraft input log 1";
+
+InputRecorder::InputRecorder()
+    : m_file(), m_pending()
+{}
+
+bool InputRecorder::open(const std::string &path) {
+    m_file.open(path, std::ios::out | std::ios::trunc);
+    if (!m_file) {
+        return false;
+    }
+    m_file << LOG_HEADER << "\n" << std::setprecision(std::numeric_limits<float>::max_digits10);
+    m_pending.clear();
+    return true;
+}
+
+bool InputRecorder::isOpen() const {
+    return m_file.is_open();
+}
+
+void InputRecorder::addEvent(InputEvent event) {
+    m_pending.push_back(event);
+}
+
+void InputRecorder::writeTick(float dT, const InputBundle &inputs) {
+    m_file << dT << " " << inputs.wPressed << " " << inputs.aPressed << " " << inputs.sPressed << " "
+           << inputs.dPressed << " " << inputs.qPressed << " " << inputs.ePressed << " "
+           << inputs.spacePressed << " " << inputs.mouseX << " " << inputs.mouseY << " " << m_pending.size();
+    for (const InputEvent &event : m_pending) {
+        m_file << " " << static_cast<int>(event.type) << " " << event.code;
+    }
+    m_file << "\n";
+    m_pending.clear();
+}
+
+InputReplay::InputReplay()
+    : m_ticks(), m_next(0)
+{}
+
+bool InputReplay::load(const std::string &path) {
+    m_ticks.clear();
+    m_next = 0;
+
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line != LOG_HEADER) {
+        return false;
+    }
+
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        InputTick tick;
+        InputBundle &b = tick.inputs;
+        size_t eventCount = 0;
+        in >> tick.dT >> b.wPressed >> b.aPressed >> b.sPressed >> b.dPressed >> b.qPressed >> b.ePressed
+           >> b.spacePressed >> b.mouseX >> b.mouseY >> eventCount;
+        bool valid = static_cast<bool>(in);
+        for (size_t i = 0; i < eventCount && valid; i++) {
+            int type = -1;
+            InputEvent event;
+            in >> type >> event.code;
+            event.type = static_cast<InputEvent::Type>(type);
+            tick.events.push_back(event);
+            valid = in && type >= InputEvent::KEY_PRESS && type <= InputEvent::MOUSE_PRESS;
+        }
+        if (!valid) {
+            m_ticks.clear();
+            return false;
+        }
+        m_ticks.push_back(tick);
+    }
+    return true;
+}
+
+bool InputReplay::atEnd() const {
+    return m_next >= m_ticks.size();
+}
+
+const InputTick& InputReplay::next() {
+    return m_ticks[m_next++];
+}
+
+size_t InputReplay::tickCount() const {
+    return m_ticks.size();
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "scene/entity.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A key or mouse button press that MyGL handles directly rather than
+// through the InputBundle, e.g. toggling flight or placing a block
+struct InputEvent {
+    enum Type : unsigned char {
+        KEY_PRESS, KEY_RELEASE, MOUSE_PRESS
+    };
+    Type type;
+    // The Qt::Key, or the Qt::MouseButtons held
+    int code;
+};
+
+// Everything that drove one Player::tick()
+struct InputTick {
+    float dT;
+    InputBundle inputs;
+    // Events handled since the previous tick, in order
+    std::vector<InputEvent> events;
+};
+
+// Writes an input log as the game is played, one InputTick per line, so
+// that InputReplay can drive the Player exactly as the user did. The file
+// is text, with floats written to full precision so they read back exactly:
+//   mini-minecraft input log 1
+//   <dT> <w> <a> <s> <d> <q> <e> <space> <mouseX> <mouseY> <event count> [<type> <code>]...
+class InputRecorder {
+private:
+    std::ofstream m_file;
+    std::vector<InputEvent> m_pending;
+
+public:
+    InputRecorder();
+
+    // Starts a new log at path, replacing any file there
+    bool open(const std::string &path);
+    bool isOpen() const;
+    // Holds an event for the next writeTick()
+    void addEvent(InputEvent event);
+    // Writes one tick along with every event added since the last one
+    void writeTick(float dT, const InputBundle &inputs);
+};
+
+// Reads back a log written by InputRecorder
+class InputReplay {
+private:
+    std::vector<InputTick> m_ticks;
+    size_t m_next;
+
+public:
+    InputReplay();
+
+    // Returns false, with nothing loaded, if the file is missing or malformed
+    bool load(const std::string &path);
+    bool atEnd() const;
+    // The next tick to replay. Must not be called at the end.
+    const InputTick& next();
+    size_t tickCount() const;
+};
@@ -1,6 +1,8 @@
 #include <mainwindow.h>
+#include <openglcontext.h>
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include <QSurfaceFormat>
 #include <QDebug>
 
@@ -23,12 +25,54 @@ int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // --record writes every tick's input to a log, and --replay plays one
+    // back as fast as possible, then prints frame-time percentiles and
+    // exits. A replay draws into the usual window rather than an offscreen
+    // surface, so that it times the same swap and present path as play.
+    // It needs a display but no one at it, so on a CI machine without a
+    // GPU it can run as e.g.
+    //   xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 ./MiniMinecraft --replay walk.log
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption recordOption("record", "Record each tick's input to <file>.", "file");
+    QCommandLineOption replayOption("replay", "Replay the input recorded in <file> in the game window, print frame times and exit.\n"
+                                    "Needs a display; use xvfb-run on a machine without one.", "file");
+    // The world is saved to and loaded from --world. Recording and replaying
+    // start from freshly generated terrain unless one is given, so that
+    // edits saved since the recording can't change what a replay sees.
+    QCommandLineOption worldOption("world", "Save the world to and load it from <directory> (default: world).",
+                                   "directory", "world");
+    // Chunks are unloaded (saved first, if need be) beyond this distance,
+    // or when they take up more memory than this
+    QCommandLineOption radiusOption("keep-radius", "Unload terrain further than <blocks> away (default 384).",
+                                    "blocks", "384");
+    QCommandLineOption budgetOption("memory-budget", "Unload the least recently seen terrain past <MiB> (default 512).",
+                                    "MiB", "512");
+    // Frames are drawn as fast as they are shown, which vsync normally
+    // caps at the display's rate; --uncapped turns vsync off
+    QCommandLineOption uncappedOption("uncapped", "Draw frames as fast as possible instead of at the display's rate.");
+    parser.addOption(recordOption);
+    parser.addOption(replayOption);
+    parser.addOption(uncappedOption);
+    parser.addOption(worldOption);
+    parser.addOption(radiusOption);
+    parser.addOption(budgetOption);
+    parser.process(a);
+
     // Set OpenGL 4.0 and, optionally, 4-sample multisampling
     QSurfaceFormat format;
     format.setVersion(4, 0);
     format.setOption(QSurfaceFormat::DeprecatedFunctions, false);
     format.setProfile(QSurfaceFormat::CoreProfile);
+    // A replay is timed, so it shouldn't wait on vsync either
+    if (parser.isSet(replayOption) || parser.isSet(uncappedOption)) {
+        format.setSwapInterval(0);
+    }
     //format.setSamples(4);  // Uncomment for nice antialiasing. Not always supported.
+    // Lets the driver report errors through KHR_debug; see OpenGLContext
+    if (OpenGLContext::debugOutputRequested()) {
+        format.setOption(QSurfaceFormat::DebugContext);
+    }
 
     /*** AUTOMATIC TESTING: DO NOT MODIFY ***/
     /*** Check whether automatic testing is enabled */
@@ -38,7 +82,29 @@ int main(int argc, char *argv[])
     debugFormatVersion();
 
     MainWindow w;
+    bool fresh = parser.isSet(recordOption) || parser.isSet(replayOption);
+    if ((parser.isSet(worldOption) || !fresh) && !w.openWorld(parser.value(worldOption))) {
+        qCritical() << "Could not open the world directory" << parser.value(worldOption);
+        return 1;
+    }
+    bool radiusOk, budgetOk;
+    int radius = parser.value(radiusOption).toInt(&radiusOk);
+    int budget = parser.value(budgetOption).toInt(&budgetOk);
+    if (!radiusOk || !budgetOk || radius <= 0 || budget <= 0) {
+        qCritical() << "--keep-radius and --memory-budget must be positive numbers";
+        return 1;
+    }
+    w.setEvictionLimits(radius, budget);
     w.show();
 
+    if (parser.isSet(recordOption) && !w.startRecording(parser.value(recordOption))) {
+        qCritical() << "Could not open" << parser.value(recordOption) << "for recording";
+        return 1;
+    }
+    if (parser.isSet(replayOption) && !w.startReplay(parser.value(replayOption))) {
+        qCritical() << "Could not read the input log" << parser.value(replayOption);
+        return 1;
+    }
+
     return a.exec();
 }
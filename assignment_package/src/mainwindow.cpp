@@ -18,6 +18,12 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->mygl, SIGNAL(sig_sendPlayerLook(QString)), &playerInfoWindow, SLOT(slot_setLookText(QString)));
     connect(ui->mygl, SIGNAL(sig_sendPlayerChunk(QString)), &playerInfoWindow, SLOT(slot_setChunkText(QString)));
     connect(ui->mygl, SIGNAL(sig_sendPlayerTerrainZone(QString)), &playerInfoWindow, SLOT(slot_setZoneText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendMeshStats(QString)), &playerInfoWindow, SLOT(slot_setMeshText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendBufferStats(QString)), &playerInfoWindow, SLOT(slot_setBufferText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendDrawStats(QString)), &playerInfoWindow, SLOT(slot_setDrawText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendArenaStats(QString)), &playerInfoWindow, SLOT(slot_setArenaText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendGpuStats(QString)), &playerInfoWindow, SLOT(slot_setGpuText(QString)));
+    connect(ui->mygl, SIGNAL(sig_sendMemoryStats(QString)), &playerInfoWindow, SLOT(slot_setMemoryText(QString)));
 }
 
 MainWindow::~MainWindow()
@@ -25,6 +31,26 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+bool MainWindow::openWorld(const QString &directory)
+{
+    return ui->mygl->openWorld(directory);
+}
+
+void MainWindow::setEvictionLimits(int radius, int memoryBudgetMiB)
+{
+    ui->mygl->setEvictionLimits(radius, memoryBudgetMiB);
+}
+
+bool MainWindow::startRecording(const QString &path)
+{
+    return ui->mygl->startRecording(path);
+}
+
+bool MainWindow::startReplay(const QString &path)
+{
+    return ui->mygl->startReplay(path);
+}
+
 void MainWindow::on_actionQuit_triggered()
 {
     QApplication::exit();
@@ -19,6 +19,12 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    // See the MyGL functions of the same names
+    bool openWorld(const QString &directory);
+    void setEvictionLimits(int radius, int memoryBudgetMiB);
+    bool startRecording(const QString &path);
+    bool startReplay(const QString &path);
+
 private slots:
     void on_actionQuit_triggered();
 
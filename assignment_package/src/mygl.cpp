@@ -5,21 +5,47 @@
 #include <QApplication>
 #include <QKeyEvent>
 #include <QDateTime>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QThread>
+#include <algorithm>
+#include <climits>
+#include "tracer.h"
+
+// How many generated Chunks updateWorld() moves into the Terrain at most per call
+static const unsigned int MAX_CHUNKS_INSERTED_PER_TICK = 4;
+// The simulation always advances in steps of this many seconds, however
+// fast frames are drawn
+static const float SIMULATION_STEP = 1.f / 60.f;
+// When a tick falls further behind than this many steps, the rest of the
+// time is dropped, so that a slow frame can't snowball into ever more steps
+static const int MAX_STEPS_PER_TICK = 5;
+// How many modified Chunks updateWorld() writes to disk at most per call
+static const unsigned int MAX_CHUNKS_SAVED_PER_TICK = 4;
+// How many zones (of 4 x 4 Chunks) updateWorld() unloads at most per call
+static const unsigned int MAX_ZONES_EVICTED_PER_TICK = 1;
+// How many meshes built by the worker threads get uploaded to the GPU at most per frame
+static const unsigned int MAX_MESH_UPLOADS_PER_FRAME = 8;
 
 
 MyGL::MyGL(QWidget *parent)
     : OpenGLContext(parent),
       m_worldAxes(this),
       m_progLambert(this), m_progFlat(this), m_progInstanced(this), m_progSky(this),
-      m_geomQuad(this), m_terrain(this),
-      m_player(glm::vec3(64.f, 150.f, 64.f), m_terrain),m_lastMSecs(QDateTime::currentMSecsSinceEpoch()),
-      m_time(0.f),
+      m_geomQuad(this), timeSky(0.f), m_terrain(this),
+      m_player(glm::vec3(64.f, 150.f, 64.f), m_terrain), m_simClock(), m_simAccumulator(0.0),
+      m_time(0), m_frameUniforms(this), m_gpuProfiler(this),
+      m_recorder(), m_replay(), m_replaying(false), m_replayFrameMillis(), m_replayWaitNanos(0), m_replayClock(),
       m_buffer(this,this->width(),this->height(),this->devicePixelRatio()), m_postProcessShaders()
 {
     // Connect the timer to a function so that when the timer ticks the function is executed
     connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
-    // Tell the timer to redraw 60 times per second
+    // Tell the timer to fire 60 times per second. Frames are mostly driven
+    // by nextFrame(); the timer keeps the world going when none are shown.
     m_timer.start(16);
+    // Draw the next frame as soon as the last one is on screen: at the
+    // display's rate with vsync on, as fast as possible without it
+    connect(this, SIGNAL(frameSwapped()), this, SLOT(nextFrame()));
     setFocusPolicy(Qt::ClickFocus);
 
     setMouseTracking(true); // MyGL will track the mouse's movements even if a mouse button is not pressed
@@ -29,6 +55,8 @@ MyGL::MyGL(QWidget *parent)
 MyGL::~MyGL() {
     makeCurrent();
     glDeleteVertexArrays(1, &vao);
+    m_frameUniforms.destroy();
+    m_gpuProfiler.destroy();
     m_geomQuad.destroyVBOdata();
     m_buffer.destroy();
 }
@@ -43,8 +71,10 @@ void MyGL::initializeGL()
     // Create an OpenGL context using Qt's QOpenGLFunctions_3_2_Core class
     // If you were programming in a non-Qt context you might use GLEW (GL Extension Wrangler)instead
     initializeOpenGLFunctions();
+    initializeDebugOutput();
     // Print out some information about the current OpenGL context
     debugContextVersion();
+    Tracer::setThreadName("Main");
 
     // Set a few settings/modes in OpenGL rendering
     glEnable(GL_DEPTH_TEST);
@@ -64,6 +94,8 @@ void MyGL::initializeGL()
     glGenVertexArrays(1, &vao);
 
     m_buffer.create();//creating buffer data
+    m_frameUniforms.create();
+    m_gpuProfiler.create();
 
     m_geomQuad.createVBOdata();
     //Create the instance of the world axes
@@ -104,8 +136,20 @@ void MyGL::initializeGL()
     // and UV coordinates
     m_progLambert.setGeometryColor(glm::vec4(0,1,0,1));
 
-    // We have to have a VAO bound in OpenGL 3.2 Core. But if we're not
-    // using multiple VAOs, we can just bind one once.
+    // Chunk vertices only store their BlockType, so hand the shader
+    // the color of each one. Anything without a color is magenta.
+    std::vector<glm::vec4> blockColors(16, glm::vec4(1, 0, 1, 1));
+    for (auto &entry : colorMap) {
+        blockColors[entry.first] = entry.second;
+    }
+    m_progLambert.setBlockColors(blockColors);
+
+    // Allocate the shared buffers that every Chunk's mesh is uploaded into
+    m_terrain.initializeGL();
+
+    // We have to have a VAO bound in OpenGL 3.2 Core. Everything but the
+    // Terrain shares this one; the Terrain's renderer binds its own while
+    // it draws, after which renderTerrain() rebinds this one.
     glBindVertexArray(vao);
 
     // Set texture map once in MyGL so it isn't reinitialized for every chunk
@@ -121,15 +165,8 @@ void MyGL::resizeGL(int w, int h) {
     m_buffer.destroy();
     m_buffer.create();
     m_player.setCameraWidthHeight(static_cast<unsigned int>(w), static_cast<unsigned int>(h));
-    glm::mat4 viewproj = m_player.mcr_camera.getViewProj();
-
-    // Upload the view-projection matrix to our shaders (i.e. onto the graphics card)
-
-    m_progLambert.setViewProjMatrix(viewproj);
-    m_progFlat.setViewProjMatrix(viewproj);
-    // Sky shader
-    m_progSky.setViewProjMatrix(glm::inverse(viewproj));
-
+    // The view-projection matrix reaches the shaders through m_frameUniforms,
+    // which paintGL() refreshes every frame
 
 
     m_progPostprocessCurrent->setDimensions(glm::ivec2(w * this->devicePixelRatio(),
@@ -149,24 +186,209 @@ void MyGL::resizeGL(int w, int h) {
 }
 
 
-// MyGL's constructor links tick() to a timer that fires 60 times per second.
+// MyGL's constructor links tick() to a timer that fires 60 times per second,
+// and to every frame being presented.
 // We're treating MyGL as our game engine class, so we're going to perform
 // all per-frame actions here, such as performing physics updates on all
 // entities in the scene.
 void MyGL::tick() {
-    m_terrain.checkForNewChunks();
+    if (m_replaying) {
+        replayTick();
+        return;
+    }
+    TRACE_SCOPE("MyGL::tick");
     update(); // Calls paintGL() as part of a larger QOpenGLWidget pipeline
-    playerTick(); // Calculates dT and calls Player::tick()
-    sendPlayerDataToGUI(); // Updates the info in the secondary window displaying player data
+    // Only drawing keeps up with the display. Everything else happens
+    // at most once per tick that the simulation moved, so a faster
+    // display doesn't stream, save or scan the Terrain any more often.
+    if (advanceSimulation() > 0) {
+        updateWorld();
+    }
+}
+
+void MyGL::updateWorld() {
+    TRACE_SCOPE("MyGL::updateWorld");
+    // Pick up a bounded number of Chunks the worker threads have finished
+    // generating so a burst of completions can't stall a single frame
+    m_terrain.insertGeneratedChunks(MAX_CHUNKS_INSERTED_PER_TICK);
+    m_terrain.checkForNewChunks(m_player.mcr_position);
+    // Spread saving out over ticks, so edits and new Chunks reach disk
+    // soon without any one tick writing many at once
+    m_terrain.saveModifiedChunks(MAX_CHUNKS_SAVED_PER_TICK);
+    m_terrain.evictChunks(m_player.mcr_position, MAX_ZONES_EVICTED_PER_TICK);
+    {
+        TRACE_SCOPE("MyGL::sendPlayerDataToGUI");
+        sendPlayerDataToGUI(); // Updates the info in the secondary window displaying player data
+    }
 
     m_progPostprocessCurrent = m_postProcessShaders[m_player.medium].get();
 }
 
-void MyGL::playerTick() {
-    qint64 currentMSecs = QDateTime::currentMSecsSinceEpoch();
-    float dT = (currentMSecs - m_lastMSecs) / 1000.f;
-    m_player.tick(dT, m_inputs);
-    m_lastMSecs = currentMSecs;
+void MyGL::nextFrame() {
+    // A replay draws its frames itself, with repaint(), which would
+    // otherwise end up back here
+    if (!m_replaying) {
+        tick();
+    }
+}
+
+bool MyGL::openWorld(const QString &directory) {
+    return m_terrain.openWorld(directory.toStdString());
+}
+
+void MyGL::setEvictionLimits(int radius, int memoryBudgetMiB) {
+    m_terrain.setEvictionLimits(radius, static_cast<size_t>(memoryBudgetMiB) << 20);
+}
+
+bool MyGL::startRecording(const QString &path) {
+    return m_recorder.open(path.toStdString());
+}
+
+bool MyGL::startReplay(const QString &path) {
+    if (!m_replay.load(path.toStdString())) {
+        return false;
+    }
+    m_replaying = true;
+    m_replayFrameMillis.clear();
+    m_replayFrameMillis.reserve(m_replay.tickCount());
+    m_replayWaitNanos = 0;
+    // Run the next tick as soon as the last frame is done
+    m_timer.setInterval(0);
+    return true;
+}
+
+void MyGL::replayTick() {
+    if (m_replay.atEnd()) {
+        finishReplay();
+        return;
+    }
+    if (!m_replayClock.isValid()) {
+        m_replayClock.start();
+    }
+
+    // Live play holds the Player in place until the Chunks around it
+    // arrive, and never records those ticks. A replay waits for them
+    // instead, so that every tick it plays sees the same terrain.
+    QElapsedTimer wait;
+    wait.start();
+    while (!m_terrain.hasChunksAround(m_player.mcr_position, 2)) {
+        m_terrain.checkForNewChunks(m_player.mcr_position);
+        m_terrain.insertGeneratedChunks(UINT_MAX);
+        QThread::msleep(1);
+    }
+    m_replayWaitNanos += wait.nsecsElapsed();
+
+    TRACE_SCOPE("MyGL::replayTick");
+    QElapsedTimer frame;
+    frame.start();
+
+    const InputTick &tick = m_replay.next();
+    for (const InputEvent &event : tick.events) {
+        switch (event.type) {
+        case InputEvent::KEY_PRESS:
+            if (event.code != Qt::Key_Escape) {
+                handleKeyPress(event.code);
+            }
+            break;
+        case InputEvent::KEY_RELEASE:
+            handleKeyRelease(event.code);
+            break;
+        case InputEvent::MOUSE_PRESS:
+            handleMousePress(event.code);
+            break;
+        }
+    }
+    m_inputs = tick.inputs;
+    // The recorded dT rather than the wall clock's, so the simulation
+    // doesn't depend on how fast the frames are drawn
+    simulationStep(tick.dT);
+    // The same streaming, saving and eviction as live play, so that a
+    // replay pays for them too
+    updateWorld();
+
+    // Draws the frame right away; paintGL() waits for the GPU to finish it
+    repaint();
+    m_replayFrameMillis.push_back(frame.nsecsElapsed() / 1e6f);
+}
+
+void MyGL::finishReplay() {
+    m_timer.stop();
+    m_replaying = false;
+
+    std::vector<float> sorted = m_replayFrameMillis;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](float p) {
+        if (sorted.empty()) {
+            return 0.f;
+        }
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p / 100.f * sorted.size()))];
+    };
+    float total = 0.f;
+    for (float ms : sorted) {
+        total += ms;
+    }
+
+    const LoadStats &loads = m_terrain.getLoadStats();
+    std::cout << "Replayed " << sorted.size() << " ticks in " << m_replayClock.elapsed() << " ms, "
+              << m_replayWaitNanos / 1000000 << " ms of it waiting for terrain\n"
+              << "Frame ms: mean " << (sorted.empty() ? 0.f : total / sorted.size())
+              << ", p50 " << percentile(50) << ", p95 " << percentile(95) << ", p99 " << percentile(99)
+              << ", max " << percentile(100) << "\n"
+              << "Chunks loaded: " << loads.chunksInserted << ", meshes built: " << loads.meshesUploaded
+              << std::endl;
+    if (m_gpuProfiler.isSupported()) {
+        // The profiler only keeps a rolling window, so these cover the
+        // end of the replay
+        for (int pass = 0; pass < NUM_GPU_PASSES; pass++) {
+            PassTimings timings = m_gpuProfiler.timings(static_cast<GpuPass>(pass));
+            std::cout << "GPU " << GpuProfiler::passName(static_cast<GpuPass>(pass)) << " ms over "
+                      << timings.samples << " frames: mean " << timings.average << ", p50 " << timings.median
+                      << ", p95 " << timings.p95 << ", max " << timings.max << "\n";
+        }
+        std::cout << std::flush;
+    }
+    QApplication::quit();
+}
+
+int MyGL::advanceSimulation() {
+    if (!m_simClock.isValid()) {
+        m_simClock.start();
+        return 0;
+    }
+    qint64 elapsed = m_simClock.nsecsElapsed();
+    m_simClock.start();
+    m_simAccumulator = std::min(m_simAccumulator + elapsed / 1e9, static_cast<double>(MAX_STEPS_PER_TICK * SIMULATION_STEP));
+    int steps = 0;
+    while (m_simAccumulator >= SIMULATION_STEP) {
+        simulationStep(SIMULATION_STEP);
+        m_simAccumulator -= SIMULATION_STEP;
+        steps++;
+    }
+    return steps;
+}
+
+void MyGL::simulationStep(float dT) {
+    // Terrain is generated in the background, so hold the player in place
+    // until the Chunks it could collide with have arrived
+    if (m_terrain.hasChunksAround(m_player.mcr_position, 2)) {
+        if (m_recorder.isOpen()) {
+            m_recorder.writeTick(dT, m_inputs);
+        }
+        m_player.tick(dT, m_inputs);
+    } else {
+        m_player.savePreviousState();
+    }
+    timeSky++;
+    m_time++;
+}
+
+float MyGL::interpolationAlpha() const {
+    // A replay draws exactly the state each recorded step left behind
+    if (m_replaying || !m_simClock.isValid()) {
+        return 1.f;
+    }
+    double pending = m_simAccumulator + m_simClock.nsecsElapsed() / 1e9;
+    return static_cast<float>(std::min(pending / SIMULATION_STEP, 1.0));
 }
 
 void MyGL::sendPlayerDataToGUI() const {
@@ -179,6 +401,64 @@ void MyGL::sendPlayerDataToGUI() const {
     glm::ivec2 zone(64 * glm::ivec2(glm::floor(pPos / 64.f)));
     emit sig_sendPlayerChunk(QString::fromStdString("( " + std::to_string(chunk.x) + ", " + std::to_string(chunk.y) + " )"));
     emit sig_sendPlayerTerrainZone(QString::fromStdString("( " + std::to_string(zone.x) + ", " + std::to_string(zone.y) + " )"));
+    MeshStats mesh = m_terrain.getMeshStats();
+    emit sig_sendMeshStats(QString::fromStdString(std::to_string(mesh.visibleFaces) + " faces (" +
+                                                  std::to_string(mesh.hiddenFaces) + " hidden), " +
+                                                  std::to_string(mesh.quads) + " quads, " +
+                                                  std::to_string(mesh.totalBytes() / 1024) + " KiB"));
+    const DrawStats &draws = m_terrain.getDrawStats();
+    emit sig_sendDrawStats(QString::fromStdString(std::to_string(draws.chunksDrawn) + " drawn (" +
+                                                  std::to_string(draws.sectionsDrawn) + " sections in " +
+                                                  std::to_string(draws.drawCalls) + " draws), " +
+                                                  std::to_string(draws.chunksCulled) + " culled, " +
+                                                  std::to_string(draws.chunksOccluded) + " occluded"));
+    // Chunk meshes live in the two arenas; the other Drawables have their own buffers
+    ArenaStats vertexArena = m_terrain.getVertexArenaStats();
+    ArenaStats indexArena = m_terrain.getIndexArenaStats();
+    emit sig_sendBufferStats(QString::fromStdString(std::to_string(Drawable::liveBufferCount()) + " buffers, " +
+                                                    std::to_string((vertexArena.usedBytes + indexArena.usedBytes) / 1024) + "/" +
+                                                    std::to_string((vertexArena.capacity + indexArena.capacity) / 1024) +
+                                                    " KiB of chunk arenas used"));
+    // e.g. "V 12/16 MiB 3% frag, I 5/16 MiB 0% frag, 384 meshes"
+    auto describeArena = [](const char *name, const ArenaStats &arena) {
+        return std::string(name) + " " + std::to_string(arena.usedBytes >> 20) + "/" +
+               std::to_string(arena.capacity >> 20) + " MiB " +
+               std::to_string(static_cast<int>(arena.fragmentation() * 100)) + "% frag";
+    };
+    emit sig_sendArenaStats(QString::fromStdString(describeArena("V", vertexArena) + ", " +
+                                                   describeArena("I", indexArena) + ", " +
+                                                   std::to_string(vertexArena.allocations) + " meshes"));
+    // e.g. "2304 chunks, 231 MiB, 512 evicted"
+    emit sig_sendMemoryStats(QString::fromStdString(std::to_string(m_terrain.getChunkCount()) + " chunks, " +
+                                                    std::to_string(m_terrain.getMemoryBytes() >> 20) + " MiB, " +
+                                                    std::to_string(m_terrain.getLoadStats().chunksEvicted) + " evicted"));
+    // e.g. "sky 0.05/0.07, opaque 1.20/1.84, ..." as average/95th percentile
+    if (m_gpuProfiler.isSupported()) {
+        QStringList passes;
+        for (int pass = 0; pass < NUM_GPU_PASSES; pass++) {
+            PassTimings timings = m_gpuProfiler.timings(static_cast<GpuPass>(pass));
+            passes << QString("%1 %2/%3").arg(GpuProfiler::passName(static_cast<GpuPass>(pass)))
+                                         .arg(timings.average, 0, 'f', 2).arg(timings.p95, 0, 'f', 2);
+        }
+        emit sig_sendGpuStats(passes.join(", "));
+    } else {
+        emit sig_sendGpuStats("timer queries unsupported");
+    }
+}
+
+void MyGL::toggleTracing() {
+    if (!Tracer::enabled()) {
+        Tracer::start();
+        std::cout << "Tracing started, press T again to save it" << std::endl;
+        return;
+    }
+    Tracer::stop();
+    std::string path = "trace-" + std::to_string(QDateTime::currentMSecsSinceEpoch()) + ".json";
+    if (Tracer::writeChromeTrace(path)) {
+        std::cout << "Trace written to " << path << std::endl;
+    } else {
+        std::cerr << "Could not write trace to " << path << std::endl;
+    }
 }
 
 void MyGL::bindTextureMap() {
@@ -186,42 +466,51 @@ void MyGL::bindTextureMap() {
 }
 
 // This function is called whenever update() is called.
-// MyGL's constructor links update() to a timer that fires 60 times per second,
-// so paintGL() called at a rate of 60 frames per second.
+// tick() calls update() whenever the timer fires or a frame is presented,
+// so paintGL() is called as fast as frames can be shown.
 void MyGL::paintGL() {
+    TRACE_SCOPE("MyGL::paintGL");
+    m_gpuProfiler.beginFrame();
+
     //frame buffer stuff here
     m_buffer.bindFrameBuffer();
     glViewport(0,0,this->width()*this->devicePixelRatio(),this->height()*this->devicePixelRatio());
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    m_progFlat.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-    m_progLambert.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-    m_progInstanced.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-
-    // Sky shader
-   //paste back here
-    glDisable(GL_DEPTH_TEST);
-    m_progSky.setViewProjMatrix(glm::inverse(m_player.mcr_camera.getViewProj()));
-    m_progSky.useMe();
-    this->glUniform3f(m_progSky.unifEye, m_player.mcr_position.x, m_player.mcr_position.y, m_player.mcr_position.z);
-    this->glUniform1f(m_progSky.unifTimeSky, timeSky++);
-    m_progSky.draw(m_geomQuad);
+    // The sky's clock advances with the simulation, not once per frame
+    float skyTime = timeSky;
     float theta = timeSky * 0.001 * 3.14159265359;
     sunDir = glm::vec3(0, cos(theta), sin(theta));
     sunDir = glm::normalize(sunDir);
-    glEnable(GL_DEPTH_TEST);
 
-    printGLErrorLog();
+    // The Player only moves in fixed steps, so draw it part of the way
+    // between the last two for motion to look smooth at any frame rate
+    float alpha = interpolationAlpha();
+    Camera camera = m_player.interpolatedCamera(alpha);
+    glm::vec3 eye = m_player.interpolatedPosition(alpha);
 
-    m_progLambert.setTime(m_time);
-    m_progPostprocessCurrent->setTime(m_time);
-    m_time++;
+    // Everything every program needs this frame, uploaded once for all of them
+    FrameData frame;
+    frame.viewProj = camera.getViewProj();
+    frame.invViewProj = glm::inverse(frame.viewProj);
+    frame.sunDir = sunDir;
+    frame.time = m_time;
+    m_frameUniforms.update(frame);
 
-    m_progLambert.useMe();
-    this->glUniform3f(m_progLambert.unifSunDir, sunDir.x, sunDir.y, sunDir.z);
+    // Sky shader
+    {
+        TRACE_SCOPE("MyGL::paintGL sky");
+        GpuProfiler::Scope timer(&m_gpuProfiler, SKY_PASS);
+        glDisable(GL_DEPTH_TEST);
+        m_progSky.useMe();
+        this->glUniform3f(m_progSky.unifEye, eye.x, eye.y, eye.z);
+        this->glUniform1f(m_progSky.unifTimeSky, skyTime);
+        m_progSky.draw(m_geomQuad);
+        glEnable(GL_DEPTH_TEST);
+    }
 
     printGLErrorLog();
-    renderTerrain();
+    renderTerrain(camera);
 
     //post process render pass now
     glBindFramebuffer(GL_FRAMEBUFFER,this->defaultFramebufferObject());
@@ -232,43 +521,62 @@ void MyGL::paintGL() {
 
 //    this->glUniform1i(m_progPostprocessCurrent->unifSampler2D,m_buffer.getTextureSlot());
 
-    m_progPostprocessCurrent->draw(m_geomQuad,m_buffer.getTextureSlot());
-
-    // pasted sky code - move up
-
-
-
-//    glDisable(GL_DEPTH_TEST);
-//    m_progFlat.setModelMatrix(glm::mat4());
-//    m_progFlat.setViewProjMatrix(m_player.mcr_camera.getViewProj());
-//    m_progFlat.draw(m_worldAxes);
-//    glEnable(GL_DEPTH_TEST);
+    {
+        TRACE_SCOPE("MyGL::paintGL post-process");
+        GpuProfiler::Scope timer(&m_gpuProfiler, POST_PROCESS_PASS);
+        m_progPostprocessCurrent->draw(m_geomQuad,m_buffer.getTextureSlot());
+    }
+    // So that a replay's frame times include the GPU's share
+    if (m_replaying) {
+        glFinish();
+    }
 }
 
-void MyGL::renderTerrain() {
+void MyGL::renderTerrain(const Camera &camera) {
+    TRACE_SCOPE("MyGL::renderTerrain");
     bindTextureMap();
 
-    glm::vec2 terrainPos = m_terrain.getTerrainPos();
+    // Only upload here, where the GL context is guaranteed to be current
+    m_terrain.uploadBuiltMeshes(MAX_MESH_UPLOADS_PER_FRAME);
+
+    glm::vec2 terrainPos = m_terrain.getTerrainPos(m_player.mcr_position);
 
     int terrX = static_cast<int>(terrainPos.x);
     int terrZ = static_cast<int>(terrainPos.y);
 
+    Frustum frustum(camera.getViewProj());
+    m_terrain.resetDrawStats();
+
     for (int z = terrZ - 64; z < terrZ + 128; z += 64) {
         for (int x = terrX - 64; x < terrX + 128; x += 64) {
-            if (m_terrain.hasTerrainZoneAt(x, z)) {
-                m_terrain.draw(x, x + 64, z, z + 64, &m_progLambert);
-            } else {
-                // Edit the CreateProceduralTerrain function to
-                // create more terrain for this generation zone
-                m_terrain.CreateProceduralTerrain(x,x+64,z,z+64);
-                m_terrain.draw(x, x + 64, z, z + 64, &m_progLambert);
+            if (!m_terrain.hasTerrainZoneAt(x, z)) {
+                // Queue the zone for generation on the worker threads.
+                // Its Chunks are drawn as they arrive; we never wait on them here.
+                m_terrain.requestTerrainZone(x, z);
             }
         }
     }
+
+    // Draw the whole 3 x 3 zone window at once, so that section
+    // visibility can be traced across zone borders
+    m_terrain.draw(terrX - 64, terrX + 128, terrZ - 64, terrZ + 128, &m_progLambert,
+                   frustum, camera.mcr_position, &m_gpuProfiler);
+    glBindVertexArray(vao);
 }
 
 void MyGL::keyPressEvent(QKeyEvent *e) {
-    switch (e->key()) {
+    // A replay plays the recorded keys, so the live ones are ignored
+    if (m_replaying && e->key() != Qt::Key_Escape) {
+        return;
+    }
+    if (m_recorder.isOpen()) {
+        m_recorder.addEvent({InputEvent::KEY_PRESS, e->key()});
+    }
+    handleKeyPress(e->key());
+}
+
+void MyGL::handleKeyPress(int key) {
+    switch (key) {
         case Qt::Key_Escape:
             QApplication::quit();
             break;
@@ -297,6 +605,13 @@ void MyGL::keyPressEvent(QKeyEvent *e) {
                 m_player.setFlightModeSet(true);
             }
             break;
+        case Qt::Key_G:
+            // Toggle between greedy and per-face meshing to compare them
+            m_terrain.setMeshMode(m_terrain.getMeshMode() == GREEDY ? PER_FACE : GREEDY);
+            break;
+        case Qt::Key_T:
+            toggleTracing();
+            break;
         case Qt::Key_Space:
             if (!m_player.getFlightMode() && !m_player.isJumping()) {
                 m_player.setJumping(true);
@@ -306,7 +621,17 @@ void MyGL::keyPressEvent(QKeyEvent *e) {
 }
 
 void MyGL::keyReleaseEvent(QKeyEvent *e) {
-    switch(e->key()) {
+    if (m_replaying) {
+        return;
+    }
+    if (m_recorder.isOpen()) {
+        m_recorder.addEvent({InputEvent::KEY_RELEASE, e->key()});
+    }
+    handleKeyRelease(e->key());
+}
+
+void MyGL::handleKeyRelease(int key) {
+    switch(key) {
         case Qt::Key_W:
             m_inputs.wPressed = false;
             break;
@@ -353,7 +678,18 @@ void MyGL::mouseMoveEvent(QMouseEvent *e) {
 }
 
 void MyGL::mousePressEvent(QMouseEvent *e) {
-    switch (e->buttons()) {
+    if (m_replaying) {
+        return;
+    }
+    int buttons = e->buttons();
+    if (m_recorder.isOpen()) {
+        m_recorder.addEvent({InputEvent::MOUSE_PRESS, buttons});
+    }
+    handleMousePress(buttons);
+}
+
+void MyGL::handleMousePress(int buttons) {
+    switch (buttons) {
         case Qt::LeftButton:
             m_player.removeBlock(m_terrain);
             break;
@@ -11,9 +11,13 @@
 #include "scene/terrain.h"
 #include "scene/player.h"
 #include "texture.h"
+#include "frameuniforms.h"
+#include "gpuprofiler.h"
+#include "inputlog.h"
 
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLShaderProgram>
+#include <QElapsedTimer>
 #include <smartpointerhelp.h>
 
 
@@ -44,15 +48,47 @@ private:
     InputBundle m_inputs; // A collection of variables to be updated in keyPressEvent, mouseMoveEvent, mousePressEvent, etc.
 
     QTimer m_timer; // Timer linked to tick(). Fires approximately 60 times per second.
-    qint64 m_lastMSecs;
-    GLuint m_time;
+    QElapsedTimer m_simClock; // Restarted every time tick() advances the simulation
+    double m_simAccumulator; // Seconds of real time not yet simulated, always less than one step
+    GLuint m_time; // Simulation steps so far
+    FrameUniforms m_frameUniforms; // This frame's view-projection, sun and time, read by every ShaderProgram
+    GpuProfiler m_gpuProfiler; // Times each render pass on the GPU
+
+    InputRecorder m_recorder; // Logs each tick's input while recording
+    InputReplay m_replay; // The log being played back, if any
+    bool m_replaying;
+    std::vector<float> m_replayFrameMillis; // How long each replayed tick and its frame took
+    qint64 m_replayWaitNanos; // Time spent waiting for terrain during the replay
+    QElapsedTimer m_replayClock; // Started by the first replayed tick
 
     void moveMouseToCenter(); // Forces the mouse position to the screen's center. You should call this
                               // from within a mouse move event after reading the mouse movement so that
                               // your mouse stays within the screen bounds and is always read.
-    void playerTick();
+    // Advances the simulation by as many fixed steps as real time has
+    // passed since the last call, returning how many it ran
+    int advanceSimulation();
+    // The bookkeeping that follows the simulation rather than the frame
+    // rate: streaming Chunks in and out, saving them and updating the GUI
+    void updateWorld();
+    // One step of the simulation: the Player's physics and the sky's clock
+    void simulationStep(float dT);
+    // How far the next frame falls between the last two steps, from 0 to 1
+    float interpolationAlpha() const;
+    // Plays one tick of the replay log, in place of tick()
+    void replayTick();
+    // Prints the replay's frame times and load counts, then quits
+    void finishReplay();
+
+    // What keyPressEvent, keyReleaseEvent and mousePressEvent do, minus
+    // recording, so that a replay can do the same
+    void handleKeyPress(int key);
+    void handleKeyRelease(int key);
+    void handleMousePress(int buttons);
 
     void sendPlayerDataToGUI() const;
+    // Starts CPU tracing, or stops it and writes the trace to a JSON file
+    // in the working directory for chrome://tracing or Perfetto
+    void toggleTracing();
 
     FrameBuffer m_buffer;
     vector<std::shared_ptr<PostProcessShader>> m_postProcessShaders;
@@ -82,8 +118,23 @@ public:
     void bindTextureMap();
 
     // Called from paintGL().
-    // Calls Terrain::draw().
-    void renderTerrain();
+    // Calls Terrain::draw() as seen from camera.
+    void renderTerrain(const Camera &camera);
+
+    // Saves the world to, and loads it from, directory. Call before the
+    // first frame; see Terrain::openWorld().
+    bool openWorld(const QString &directory);
+    // How far from the player, in blocks, Chunks stay loaded, and how much
+    // memory they may take; see Terrain::setEvictionLimits()
+    void setEvictionLimits(int radius, int memoryBudgetMiB);
+    // Logs the input of every tick from now on to a file at path, for
+    // startReplay() to play back
+    bool startRecording(const QString &path);
+    // Plays a log written by startRecording() as fast as frames can be
+    // drawn, ignoring live input, then prints frame-time percentiles and
+    // how many Chunks were loaded and meshed, and quits. Returns false if
+    // the log can't be read.
+    bool startReplay(const QString &path);
 protected:
     // Automatically invoked when the user
     // presses a key on the keyboard
@@ -99,7 +150,8 @@ protected:
     void mousePressEvent(QMouseEvent *e) override;
 
 private slots:
-    void tick(); // Slot that gets called ~60 times per second by m_timer firing.
+    void tick(); // Slot that gets called by m_timer firing and after every frame is presented.
+    void nextFrame(); // Slot connected to frameSwapped(), so that frames are drawn as fast as they're shown
 
 signals:
     void sig_sendPlayerPos(QString) const;
@@ -108,6 +160,12 @@ signals:
     void sig_sendPlayerLook(QString) const;
     void sig_sendPlayerChunk(QString) const;
     void sig_sendPlayerTerrainZone(QString) const;
+    void sig_sendMeshStats(QString) const;
+    void sig_sendBufferStats(QString) const;
+    void sig_sendDrawStats(QString) const;
+    void sig_sendArenaStats(QString) const;
+    void sig_sendGpuStats(QString) const;
+    void sig_sendMemoryStats(QString) const;
 };
 
 
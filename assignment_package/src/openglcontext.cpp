@@ -8,12 +8,55 @@
 
 
 OpenGLContext::OpenGLContext(QWidget *parent)
-    : QOpenGLWidget(parent)
+    : QOpenGLWidget(parent), mp_debugLogger(nullptr), m_pollGLErrors(false), m_objectLabel(nullptr)
 {}
 
 OpenGLContext::~OpenGLContext()
 {}
 
+bool OpenGLContext::debugOutputRequested()
+{
+#ifdef DEBUG_GL
+    return qgetenv("MINECRAFT_GL_DEBUG") != "0";
+#else
+    return false;
+#endif
+}
+
+void OpenGLContext::initializeDebugOutput()
+{
+#ifdef DEBUG_GL
+    QByteArray mode = qgetenv("MINECRAFT_GL_DEBUG");
+    if (mode == "0") {
+        return;
+    }
+
+    if (mode != "poll" && context()->hasExtension("GL_KHR_debug")) {
+        mp_debugLogger = new QOpenGLDebugLogger(this);
+        if (mp_debugLogger->initialize()) {
+            connect(mp_debugLogger, &QOpenGLDebugLogger::messageLogged, this,
+                    [](const QOpenGLDebugMessage &message) {
+                        // Notifications are mostly drivers describing where
+                        // they put buffers; only report real problems
+                        if (message.severity() != QOpenGLDebugMessage::NotificationSeverity) {
+                            std::cerr << "OpenGL debug: " << message.message().toStdString() << std::endl;
+                        }
+                    });
+            // Synchronous logging stalls the driver after every call, so
+            // it is only worth it when hunting for one with a breakpoint
+            mp_debugLogger->startLogging(mode == "sync" ? QOpenGLDebugLogger::SynchronousLogging
+                                                        : QOpenGLDebugLogger::AsynchronousLogging);
+            m_objectLabel = reinterpret_cast<ObjectLabelFn>(context()->getProcAddress("glObjectLabel"));
+            return;
+        }
+        delete mp_debugLogger;
+        mp_debugLogger = nullptr;
+    }
+
+    m_pollGLErrors = true;
+#endif
+}
+
 inline const char *glGS(GLenum e)
 {
     return reinterpret_cast<const char *>(glGetString(e));
@@ -48,6 +91,7 @@ void OpenGLContext::debugContextVersion()
     printf("  Renderer: %s\n", renderer);
     printf("  Version:  %s\n", version);
     printf("  GLSL:     %s\n", s_glsl);
+    printf("  Debug:    %s\n", mp_debugLogger ? "KHR_debug" : m_pollGLErrors ? "polling glGetError" : "off");
 
     QString glsl = s_glsl;
     if (ctxmajor < 3 || glsl.startsWith("1.10") || glsl.startsWith("1.20")) {
@@ -69,7 +113,7 @@ void OpenGLContext::debugContextVersion()
     }
 }
 
-void OpenGLContext::printGLErrorLog()
+void OpenGLContext::checkGLError()
 {
     GLenum error = glGetError();
     if (error != GL_NO_ERROR) {
@@ -3,19 +3,78 @@
 #include <QOpenGLWidget>
 #include <QTimer>
 #include <QOpenGLExtraFunctions>
+#include <QOpenGLDebugLogger>
+#include <string>
 
-
+// GL debugging is compiled in only when DEBUG_GL is defined (see
+// miniMinecraft.pro, which defines it for CONFIG+=gl_debug builds). Without
+// it, printGLErrorLog() and labelObject() compile to nothing, so ordinary
+// builds never poll glGetError. With it, setting the MINECRAFT_GL_DEBUG
+// environment variable picks what happens at runtime:
+//   "0"    - no checking at all
+//   "poll" - call glGetError after every draw, as before
+//   "sync" - like unset, but each message is reported from inside the
+//            offending call, so a breakpoint in the handler finds it
+//   unset  - report errors through a GL_KHR_debug callback, falling back
+//            to polling if the context doesn't support KHR_debug
 class OpenGLContext
     : public QOpenGLWidget,
       public QOpenGLExtraFunctions
 {
+private:
+    typedef void (QOPENGLF_APIENTRYP ObjectLabelFn)(GLenum identifier, GLuint name, GLsizei length,
+                                                    const GLchar *label);
+
+    // Receives KHR_debug messages. Null unless the debug callback is in use.
+    QOpenGLDebugLogger *mp_debugLogger;
+    // Whether printGLErrorLog() calls glGetError
+    bool m_pollGLErrors;
+    // glObjectLabel, when KHR_debug is in use
+    ObjectLabelFn m_objectLabel;
+
+    // Reads one error with glGetError and reports it
+    void checkGLError();
 
 public:
     OpenGLContext(QWidget *parent);
     ~OpenGLContext();
 
+    // Should the context be created with QSurfaceFormat::DebugContext?
+    static bool debugOutputRequested();
+    // Starts the KHR_debug logger or glGetError polling, as configured
+    // above. Call from initializeGL(), after initializeOpenGLFunctions().
+    void initializeDebugOutput();
+
+    // Prints the context's version and renderer, and which debug output
+    // initializeDebugOutput() turned on
     void debugContextVersion();
     void printGLErrorLog();
     void printLinkInfoLog(int prog);
     void printShaderInfoLog(int shader);
+    // Names a GL object in debug messages and graphics debuggers.
+    // identifier is e.g. GL_BUFFER or GL_PROGRAM, and the object must
+    // already have been bound (or linked) once.
+    void labelObject(GLenum identifier, GLuint name, const std::string &label);
 };
+
+inline void OpenGLContext::printGLErrorLog()
+{
+#ifdef DEBUG_GL
+    if (m_pollGLErrors) {
+        checkGLError();
+    }
+#endif
+}
+
+inline void OpenGLContext::labelObject(GLenum identifier, GLuint name, const std::string &label)
+{
+#ifdef DEBUG_GL
+    if (m_objectLabel) {
+        m_objectLabel(identifier, name, static_cast<GLsizei>(label.size()), label.c_str());
+    }
+#else
+    Q_UNUSED(identifier);
+    Q_UNUSED(name);
+    Q_UNUSED(label);
+#endif
+}
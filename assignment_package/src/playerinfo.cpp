@@ -36,3 +36,26 @@ void PlayerInfo::slot_setZoneText(QString s) {
     ui->zoneLabel->setText(s);
 }
 
+void PlayerInfo::slot_setMeshText(QString s) {
+    ui->meshLabel->setText(s);
+}
+
+void PlayerInfo::slot_setBufferText(QString s) {
+    ui->bufferLabel->setText(s);
+}
+
+void PlayerInfo::slot_setDrawText(QString s) {
+    ui->drawLabel->setText(s);
+}
+
+void PlayerInfo::slot_setArenaText(QString s) {
+    ui->arenaLabel->setText(s);
+}
+
+void PlayerInfo::slot_setGpuText(QString s) {
+    ui->gpuLabel->setText(s);
+}
+
+void PlayerInfo::slot_setMemoryText(QString s) {
+    ui->memoryLabel->setText(s);
+}
@@ -20,6 +20,12 @@ public slots:
     void slot_setLookText(QString);
     void slot_setChunkText(QString);
     void slot_setZoneText(QString);
+    void slot_setMeshText(QString);
+    void slot_setBufferText(QString);
+    void slot_setDrawText(QString);
+    void slot_setArenaText(QString);
+    void slot_setGpuText(QString);
+    void slot_setMemoryText(QString);
 
 private:
     Ui::PlayerInfo *ui;
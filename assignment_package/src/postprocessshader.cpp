@@ -15,7 +15,6 @@ void PostProcessShader::setupMemberVars()
     attrPos = context->glGetAttribLocation(prog, "vs_Pos");
     attrUV  = context->glGetAttribLocation(prog, "vs_UV");
 
-    unifTime = context->glGetUniformLocation(prog, "u_Time");
     unifSampler2D = context->glGetUniformLocation(prog, "u_RenderedTexture");
     unifDimensions = context->glGetUniformLocation(prog, "u_Dimensions");
 }
@@ -0,0 +1,187 @@
+#include "blocksection.h"
+#include <algorithm>
+
+// The narrowest index width that can tell count types apart
+static unsigned int bitsFor(size_t count) {
+    if (count <= 1) {
+        return 0;
+    }
+    unsigned int bits = 1;
+    while ((size_t(1) << bits) < count) {
+        bits *= 2;
+    }
+    return bits;
+}
+
+// Packs BLOCKS palette indices into words of 64 / BITS each. Templated on
+// the width so that the shifts are constants the loops can be unrolled
+// (and vectorized) around.
+template <unsigned int BITS>
+static void packWords(const uint16_t *indices, uint64_t *words) {
+    const unsigned int perWord = 64 / BITS;
+    for (unsigned int w = 0; w < BlockSection::BLOCKS / perWord; w++) {
+        uint64_t word = 0;
+        for (unsigned int j = 0; j < perWord; j++) {
+            word |= uint64_t(indices[w * perWord + j]) << (j * BITS);
+        }
+        words[w] = word;
+    }
+}
+
+// The reverse of packWords, looking each index up in the palette. Narrow
+// indices are unpacked a byte at a time, through a table of the blocks
+// each of the 256 possible bytes stands for.
+template <unsigned int BITS>
+static void unpackWords(const uint64_t *words, const BlockType *palette, size_t paletteSize, BlockType *blocks) {
+    const unsigned int perWord = 64 / BITS;
+    const uint64_t mask = (uint64_t(1) << BITS) - 1;
+    if (BITS >= 8) {
+        for (unsigned int w = 0; w < BlockSection::BLOCKS / perWord; w++) {
+            uint64_t word = words[w];
+            for (unsigned int j = 0; j < perWord; j++) {
+                blocks[w * perWord + j] = palette[(word >> (j * BITS)) & mask];
+            }
+        }
+        return;
+    }
+
+    const unsigned int perByte = BITS >= 8 ? 1 : 8 / BITS;
+    std::array<std::array<BlockType, perByte>, 256> table;
+    for (unsigned int byte = 0; byte < 256; byte++) {
+        for (unsigned int k = 0; k < perByte; k++) {
+            // Indices past the palette never appear in the words
+            size_t index = (byte >> (k * BITS)) & mask;
+            table[byte][k] = index < paletteSize ? palette[index] : EMPTY;
+        }
+    }
+    for (unsigned int w = 0; w < BlockSection::BLOCKS / perWord; w++) {
+        uint64_t word = words[w];
+        for (unsigned int b = 0; b < 8; b++) {
+            const std::array<BlockType, perByte> &entry = table[(word >> (8 * b)) & 0xff];
+            std::copy(entry.begin(), entry.end(), blocks + w * perWord + b * perByte);
+        }
+    }
+}
+
+BlockSection::BlockSection()
+    : m_palette(), m_single(EMPTY), m_indices(), m_bits(0), m_bitsShift(0), m_perWordShift(0)
+{}
+
+void BlockSection::setIndex(unsigned int i, unsigned int paletteIndex) {
+    uint64_t &word = m_indices[i >> m_perWordShift];
+    unsigned int shift = (i & ((1u << m_perWordShift) - 1)) << m_bitsShift;
+    uint64_t mask = ((uint64_t(1) << m_bits) - 1) << shift;
+    word = (word & ~mask) | (uint64_t(paletteIndex) << shift);
+}
+
+unsigned int BlockSection::paletteIndex(BlockType t) {
+    for (size_t i = 0; i < m_palette.size(); i++) {
+        if (m_palette[i] == t) {
+            return i;
+        }
+    }
+    if (m_bits == 0 || m_palette.size() >= (size_t(1) << m_bits)) {
+        // Out of room at this width. Repacking first drops any types
+        // that have since been overwritten, so it only widens if the
+        // section really holds that many.
+        std::array<BlockType, BLOCKS> blocks;
+        copyTo(blocks);
+        pack(blocks.data(), 1);
+    }
+    m_palette.push_back(t);
+    return m_palette.size() - 1;
+}
+
+void BlockSection::pack(const BlockType *blocks, unsigned int spare) {
+    // Open air and solid rock are common enough to check for up front
+    if (spare == 0 && std::all_of(blocks + 1, blocks + BLOCKS, [&](BlockType t) { return t == blocks[0]; })) {
+        fill(blocks[0]);
+        return;
+    }
+
+    // Which palette entry each type became, plus one, or 0 if it hasn't
+    // been seen yet
+    std::array<uint16_t, size_t(1) << (8 * sizeof(BlockType))> found{};
+    std::vector<BlockType> palette;
+    std::array<uint16_t, BLOCKS> indices;
+    for (unsigned int i = 0; i < BLOCKS; i++) {
+        uint16_t &entry = found[blocks[i]];
+        if (entry == 0) {
+            palette.push_back(blocks[i]);
+            entry = palette.size();
+        }
+        indices[i] = entry - 1;
+    }
+
+    m_palette.swap(palette);
+    m_bits = bitsFor(m_palette.size() + spare);
+    m_bitsShift = 0;
+    while ((1u << m_bitsShift) < m_bits) {
+        m_bitsShift++;
+    }
+    m_perWordShift = 6 - m_bitsShift;
+
+    m_indices.resize(BLOCKS >> m_perWordShift);
+    m_indices.shrink_to_fit();
+    switch (m_bits) {
+    case 1: packWords<1>(indices.data(), m_indices.data()); break;
+    case 2: packWords<2>(indices.data(), m_indices.data()); break;
+    case 4: packWords<4>(indices.data(), m_indices.data()); break;
+    case 8: packWords<8>(indices.data(), m_indices.data()); break;
+    default: packWords<16>(indices.data(), m_indices.data()); break;
+    }
+}
+
+void BlockSection::set(unsigned int index, BlockType t) {
+    if (m_bits == 0 && m_single == t) {
+        return;
+    }
+    unsigned int i = paletteIndex(t);
+    setIndex(index, i);
+}
+
+void BlockSection::fill(BlockType t) {
+    m_single = t;
+    std::vector<BlockType>().swap(m_palette);
+    m_bits = m_bitsShift = m_perWordShift = 0;
+    std::vector<uint64_t>().swap(m_indices);
+}
+
+void BlockSection::assign(const std::array<BlockType, BLOCKS> &blocks) {
+    pack(blocks.data(), 0);
+}
+
+void BlockSection::compact() {
+    if (m_bits == 0) {
+        return;
+    }
+    std::array<BlockType, BLOCKS> blocks;
+    copyTo(blocks);
+    pack(blocks.data(), 0);
+}
+
+void BlockSection::copyTo(std::array<BlockType, BLOCKS> &blocks) const {
+    if (m_bits == 0) {
+        blocks.fill(m_single);
+        return;
+    }
+    switch (m_bits) {
+    case 1: unpackWords<1>(m_indices.data(), m_palette.data(), m_palette.size(), blocks.data()); break;
+    case 2: unpackWords<2>(m_indices.data(), m_palette.data(), m_palette.size(), blocks.data()); break;
+    case 4: unpackWords<4>(m_indices.data(), m_palette.data(), m_palette.size(), blocks.data()); break;
+    case 8: unpackWords<8>(m_indices.data(), m_palette.data(), m_palette.size(), blocks.data()); break;
+    default: unpackWords<16>(m_indices.data(), m_palette.data(), m_palette.size(), blocks.data()); break;
+    }
+}
+
+bool BlockSection::isSingleType() const {
+    return m_bits == 0;
+}
+
+unsigned int BlockSection::bitsPerBlock() const {
+    return m_bits;
+}
+
+size_t BlockSection::memoryBytes() const {
+    return m_palette.capacity() * sizeof(BlockType) + m_indices.capacity() * sizeof(uint64_t);
+}
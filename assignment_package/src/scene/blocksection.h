@@ -0,0 +1,74 @@
+#pragma once
+#include "chunkhelpers.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The blocks of one 16 x 16 x 16 section of a Chunk, stored as indices
+// into a palette of the BlockTypes found in it. The indices are packed
+// into 64-bit words at 1, 2, 4 or 8 bits each, only as many as the palette
+// needs, and widen when a new type no longer fits. A section holding a
+// single type, like open air or solid stone, keeps just that type and
+// allocates nothing at all. Since the indices don't depend on how wide
+// BlockType is, more types only make the palette entries bigger.
+// Blocks are indexed x + 16 * y + 256 * z.
+class BlockSection {
+public:
+    static const unsigned int BLOCKS = 16 * 16 * 16;
+
+private:
+    // Every type placed in the section since it was last packed, though
+    // not necessarily still in it. Empty for a single-type section.
+    std::vector<BlockType> m_palette;
+    // The type of every block while there is no palette
+    BlockType m_single;
+    std::vector<uint64_t> m_indices;
+    // Bits per index, or 0 for a single-type section
+    unsigned int m_bits;
+    // log2 of m_bits, and of how many indices fit in a word
+    unsigned int m_bitsShift;
+    unsigned int m_perWordShift;
+
+    unsigned int getIndex(unsigned int i) const;
+    void setIndex(unsigned int i, unsigned int paletteIndex);
+    // Finds t in the palette, adding it if it isn't there
+    unsigned int paletteIndex(BlockType t);
+    // Rebuilds the palette from exactly the types in blocks and packs
+    // them at the narrowest width that still leaves room for spare more
+    void pack(const BlockType *blocks, unsigned int spare);
+
+public:
+    // A section of nothing but EMPTY
+    BlockSection();
+
+    BlockType get(unsigned int index) const;
+    void set(unsigned int index, BlockType t);
+    // Makes every block t, dropping the indices
+    void fill(BlockType t);
+    // Replaces every block at once, which is much faster than setting
+    // them one by one
+    void assign(const std::array<BlockType, BLOCKS> &blocks);
+    void copyTo(std::array<BlockType, BLOCKS> &blocks) const;
+    // Repacks the blocks at the narrowest width they fit, dropping
+    // palette entries that have been overwritten since
+    void compact();
+
+    // Is the section stored as a single type, with no indices? Then every
+    // block is get(0). One that became a single type block by block keeps
+    // its indices until it's next packed.
+    bool isSingleType() const;
+    unsigned int bitsPerBlock() const;
+    // Heap memory held by the palette and indices
+    size_t memoryBytes() const;
+};
+
+inline unsigned int BlockSection::getIndex(unsigned int i) const {
+    uint64_t word = m_indices[i >> m_perWordShift];
+    unsigned int shift = (i & ((1u << m_perWordShift) - 1)) << m_bitsShift;
+    return static_cast<unsigned int>(word >> shift) & ((1u << m_bits) - 1);
+}
+
+inline BlockType BlockSection::get(unsigned int index) const {
+    return m_bits == 0 ? m_single : m_palette[getIndex(index)];
+}
@@ -1,43 +1,92 @@
 ﻿#include "chunk.h"
+#include "tracer.h"
+#include <algorithm>
+#include <stdexcept>
 
 using namespace std;
 using namespace glm;
 
-Chunk::Chunk(OpenGLContext* context, int x, int z) : Drawable(context), m_blocks(), minX(x), minZ(z), m_neighbors{{XPOS, nullptr}, {XNEG, nullptr}, {ZPOS, nullptr}, {ZNEG, nullptr}}
-{
-    std::fill_n(m_blocks.begin(), 65536, EMPTY);
-
-    neighboringFaces[0].direction = XPOS;
-    neighboringFaces[1].direction = XNEG;
-    neighboringFaces[2].direction = YPOS;
-    neighboringFaces[3].direction = YNEG;
-    neighboringFaces[4].direction = ZPOS;
-    neighboringFaces[5].direction = ZNEG;
-
-    neighboringFaces[0].dirVec = vec3(1, 0, 0);
-    neighboringFaces[1].dirVec = vec3(-1, 0, 0);
-    neighboringFaces[2].dirVec = vec3(0, 1, 0);
-    neighboringFaces[3].dirVec = vec3(0, -1, 0);
-    neighboringFaces[4].dirVec = vec3(0, 0, 1);
-    neighboringFaces[5].dirVec = vec3(0, 0, -1);
-
-    neighboringFaces[0].pos = {vec4(1, 0, 0, 1), vec4(1, 0, 1, 1), vec4(1, 1, 1, 1), vec4(1, 1, 0, 1)};
-    neighboringFaces[1].pos = {vec4(0, 0, 1, 1), vec4(0, 0, 0, 1), vec4(0, 1, 0, 1), vec4(0, 1, 1, 1)};
-    neighboringFaces[2].pos = {vec4(0, 1, 0, 1), vec4(1, 1, 0, 1), vec4(1, 1, 1, 1), vec4(0, 1, 1, 1)};
-    neighboringFaces[3].pos = {vec4(0, 0, 0, 1), vec4(0, 0, 1, 1), vec4(1, 0, 1, 1), vec4(1, 0, 0, 1)};
-    neighboringFaces[4].pos = {vec4(1, 0, 1, 1), vec4(0, 0, 1, 1), vec4(0, 1, 1, 1), vec4(1, 1, 1, 1)};
-    neighboringFaces[5].pos = {vec4(0, 0, 0, 1), vec4(1, 0, 0, 1), vec4(1, 1, 0, 1), vec4(0, 1, 0, 1)};
+// The geometry of each of the six faces of a unit block, shared by every Chunk
+static array<BlockFace, 6> createNeighboringFaces() {
+    array<BlockFace, 6> faces;
+
+    faces[0].direction = XPOS;
+    faces[1].direction = XNEG;
+    faces[2].direction = YPOS;
+    faces[3].direction = YNEG;
+    faces[4].direction = ZPOS;
+    faces[5].direction = ZNEG;
+
+    faces[0].dirVec = vec3(1, 0, 0);
+    faces[1].dirVec = vec3(-1, 0, 0);
+    faces[2].dirVec = vec3(0, 1, 0);
+    faces[3].dirVec = vec3(0, -1, 0);
+    faces[4].dirVec = vec3(0, 0, 1);
+    faces[5].dirVec = vec3(0, 0, -1);
+
+    faces[0].pos = {vec4(1, 0, 0, 1), vec4(1, 0, 1, 1), vec4(1, 1, 1, 1), vec4(1, 1, 0, 1)};
+    faces[1].pos = {vec4(0, 0, 1, 1), vec4(0, 0, 0, 1), vec4(0, 1, 0, 1), vec4(0, 1, 1, 1)};
+    faces[2].pos = {vec4(0, 1, 0, 1), vec4(1, 1, 0, 1), vec4(1, 1, 1, 1), vec4(0, 1, 1, 1)};
+    faces[3].pos = {vec4(0, 0, 0, 1), vec4(0, 0, 1, 1), vec4(1, 0, 1, 1), vec4(1, 0, 0, 1)};
+    faces[4].pos = {vec4(1, 0, 1, 1), vec4(0, 0, 1, 1), vec4(0, 1, 1, 1), vec4(1, 1, 1, 1)};
+    faces[5].pos = {vec4(0, 0, 0, 1), vec4(1, 0, 0, 1), vec4(1, 1, 0, 1), vec4(0, 1, 0, 1)};
 
     for (int i = 0; i < 6; i++) {
         for (int j = 0; j < 4; j++) {
-            neighboringFaces[i].nor[j] = vec4(neighboringFaces[i].dirVec, 0);
+            faces[i].nor[j] = vec4(faces[i].dirVec, 0);
         }
     }
+    return faces;
+}
+
+const static array<BlockFace, 6> neighboringFaces = createNeighboringFaces();
+
+BlockType ChunkSnapshot::getBlockAt(int x, int y, int z) const {
+    // Go into neighboring chunks if necessary and get neighboring block type
+    if (x < 0) {
+        return hasNeighbor[XNEG] ? borders[XNEG][z + 16 * y] : EMPTY;
+    } else if (x >= 16) {
+        return hasNeighbor[XPOS] ? borders[XPOS][z + 16 * y] : EMPTY;
+    } else if (y < 0) {
+        return EMPTY;
+    } else if (y >= 256) {
+        return EMPTY;
+    } else if (z < 0) {
+        return hasNeighbor[ZNEG] ? borders[ZNEG][x + 16 * y] : EMPTY;
+    } else if (z >= 16) {
+        return hasNeighbor[ZPOS] ? borders[ZPOS][x + 16 * y] : EMPTY;
+    }
+    return blocks[x + 16 * y + 16 * 256 * z];
+}
+
+bool ChunkAllocation::uploaded() const {
+    return vertices != INVALID_ARENA_HANDLE;
+}
+
+Chunk::Chunk(int x, int z) : m_sections(), minX(x), minZ(z), m_neighbors{{XPOS, nullptr}, {XNEG, nullptr}, {ZPOS, nullptr}, {ZNEG, nullptr}}, m_meshStats(), m_meshMinY(0), m_meshMaxY(0),
+      m_sectionOffsets(), m_tpSectionOffsets(), m_sectionVisibility(), m_allocation(), m_modified(true)
+{
+    m_sectionOffsets.fill(0);
+    m_tpSectionOffsets.fill(0);
+    // Until it is meshed, assume the Chunk hides nothing behind it
+    m_sectionVisibility.fill(SectionVisibility::open());
+}
+
+int Chunk::getMinX() const {
+    return minX;
 }
 
-// Does bounds checking with at()
+int Chunk::getMinZ() const {
+    return minZ;
+}
+
+// Does bounds checking, throwing std::out_of_range like at()
 BlockType Chunk::getBlockAt(unsigned int x, unsigned int y, unsigned int z) const {
-    return m_blocks.at(x + 16 * y + 16 * 256 * z);
+    if (x >= 16 || y >= 256 || z >= 16) {
+        throw std::out_of_range("Chunk::getBlockAt");
+    }
+    const BlockSection *section = m_sections[y >> 4].get();
+    return section ? section->get(x + 16 * (y & 15) + 16 * 16 * z) : EMPTY;
 }
 
 // Exists to get rid of compiler warnings about int -> unsigned int implicit conversion
@@ -45,9 +94,130 @@ BlockType Chunk::getBlockAt(int x, int y, int z) const {
     return getBlockAt(static_cast<unsigned int>(x), static_cast<unsigned int>(y), static_cast<unsigned int>(z));
 }
 
-// Does bounds checking with at()
+// Does bounds checking, throwing std::out_of_range like at()
 void Chunk::setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t) {
-    m_blocks.at(x + 16 * y + 16 * 256 * z) = t;
+    if (x >= 16 || y >= 256 || z >= 16) {
+        throw std::out_of_range("Chunk::setBlockAt");
+    }
+    uPtr<BlockSection> &section = m_sections[y >> 4];
+    m_modified = true;
+    if (!section) {
+        // Clearing a block of an empty section changes nothing
+        if (t == EMPTY) {
+            return;
+        }
+        section = mkU<BlockSection>();
+    }
+    section->set(x + 16 * (y & 15) + 16 * 16 * z, t);
+}
+
+void Chunk::compactBlocks() {
+    for (uPtr<BlockSection> &section : m_sections) {
+        if (!section) {
+            continue;
+        }
+        section->compact();
+        if (section->isSingleType() && section->get(0) == EMPTY) {
+            section.reset();
+        }
+    }
+}
+
+const BlockSection* Chunk::getSection(int section) const {
+    return m_sections[section].get();
+}
+
+void Chunk::copyBlocks(std::array<BlockType, 65536> &blocks) const {
+    std::array<BlockType, BlockSection::BLOCKS> section;
+    for (int s = 0; s < 16; s++) {
+        if (m_sections[s]) {
+            m_sections[s]->copyTo(section);
+        } else {
+            section.fill(EMPTY);
+        }
+        // Each row of 16 along x is contiguous in both layouts
+        for (int z = 0; z < 16; z++) {
+            for (int y = 0; y < 16; y++) {
+                std::copy_n(section.begin() + 16 * y + 16 * 16 * z, 16,
+                            blocks.begin() + 16 * (16 * s + y) + 16 * 256 * z);
+            }
+        }
+    }
+}
+
+void Chunk::assignBlocks(const std::array<BlockType, 65536> &blocks) {
+    std::array<BlockType, BlockSection::BLOCKS> section;
+    for (int s = 0; s < 16; s++) {
+        for (int z = 0; z < 16; z++) {
+            for (int y = 0; y < 16; y++) {
+                std::copy_n(blocks.begin() + 16 * (16 * s + y) + 16 * 256 * z, 16,
+                            section.begin() + 16 * y + 16 * 16 * z);
+            }
+        }
+        if (std::all_of(section.begin(), section.end(), [](BlockType t) { return t == EMPTY; })) {
+            m_sections[s].reset();
+            continue;
+        }
+        if (!m_sections[s]) {
+            m_sections[s] = mkU<BlockSection>();
+        }
+        m_sections[s]->assign(section);
+    }
+}
+
+std::vector<uint8_t> Chunk::serializeBlocks() const {
+    // On the heap, since this may run on a worker thread's smaller stack
+    uPtr<std::array<BlockType, 65536>> dense(new std::array<BlockType, 65536>);
+    std::array<BlockType, 65536> &blocks = *dense;
+    copyBlocks(blocks);
+    std::vector<uint8_t> data;
+    size_t i = 0;
+    while (i < blocks.size()) {
+        BlockType type = blocks[i];
+        size_t run = 1;
+        while (i + run < blocks.size() && blocks[i + run] == type && run < 65536) {
+            run++;
+        }
+        data.push_back(type);
+        data.push_back(static_cast<uint8_t>((run - 1) & 0xff));
+        data.push_back(static_cast<uint8_t>((run - 1) >> 8));
+        i += run;
+    }
+    return data;
+}
+
+bool Chunk::deserializeBlocks(const uint8_t *data, size_t bytes) {
+    if (bytes % 3 != 0) {
+        return false;
+    }
+    // Check the runs add up before touching any blocks
+    size_t total = 0;
+    for (size_t i = 0; i < bytes; i += 3) {
+        total += (data[i + 1] | data[i + 2] << 8) + 1;
+    }
+    if (total != 65536) {
+        return false;
+    }
+
+    uPtr<std::array<BlockType, 65536>> dense(new std::array<BlockType, 65536>);
+    std::array<BlockType, 65536> &blocks = *dense;
+    size_t next = 0;
+    for (size_t i = 0; i < bytes; i += 3) {
+        size_t run = (data[i + 1] | data[i + 2] << 8) + 1;
+        std::fill_n(blocks.begin() + next, run, static_cast<BlockType>(data[i]));
+        next += run;
+    }
+    assignBlocks(blocks);
+    m_modified = false;
+    return true;
+}
+
+bool Chunk::isModified() const {
+    return m_modified;
+}
+
+void Chunk::markSaved() {
+    m_modified = false;
 }
 
 
@@ -67,282 +237,459 @@ void Chunk::linkNeighbor(uPtr<Chunk> &neighbor, Direction dir) {
     }
 }
 
-void Chunk::createVBOdata() {
-    vector<int> idx;
-    vector<vec4> vbo;
-    /*
-     * Structure of vbo:
-     * pos0 nor0 col0
-     * pos1 nor1 col1 uv1
-     * pos2 nor2 col2 uv2
-     * etc
-     */
-
-    for (int z = 0; z < 16; z++) {
-        for (int y = 0; y < 256; y++) {
-            for (int x = 0; x < 16; x++) {
-                BlockType curr = getBlockAt(x, y, z);
-                if (curr != EMPTY && transparentBlocks.count(curr) == 0) {
-                    for (auto &face : neighboringFaces) {
-                        // Set position of neighboring block
-                        vec3 neighborPos = vec3(x, y, z) + face.dirVec;
-                        BlockType neighbor;
-
-                        // Go into neighboring chunks if necessary and get neighboring block type
-                        if (neighborPos.x < 0) {
-                            Chunk* neighborChunk = m_neighbors.at(XNEG);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.x += 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.x >= 16) {
-                            Chunk* neighborChunk = m_neighbors.at(XPOS);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.x -= 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.y < 0) {
-                            neighbor = EMPTY;
-                        } else if (neighborPos.y >= 16) {
-                            neighbor = EMPTY;
-                        } else if (neighborPos.z < 0) {
-                            Chunk* neighborChunk = m_neighbors.at(ZNEG);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.z += 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.z >= 16) {
-                            Chunk* neighborChunk = m_neighbors.at(ZPOS);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.z -= 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else {
-                            neighbor = getBlockAt((int) neighborPos.x, (int) neighborPos.y, (int) neighborPos.z);
-                        }
-
-                        // If the neighboring block is empty, set up the VBO
-                        if (neighbor == EMPTY || transparentBlocks.count(neighbor) > 0) {
-                            int start = vbo.size() / 4;
-
+void Chunk::unlinkNeighbors() {
+    for (auto &entry : m_neighbors) {
+        if (entry.second != nullptr) {
+            entry.second->m_neighbors[oppositeDirection.at(entry.first)] = nullptr;
+            entry.second = nullptr;
+        }
+    }
+}
 
-                            vec4 color;
-                            if (colorMap.count(curr) == 0) {
-                                color = vec4(1, 0, 1, 1);
-                            } else {
-                                color = colorMap.at(curr);
-                            }
+size_t Chunk::memoryBytes() const {
+    size_t bytes = sizeof(Chunk);
+    for (const uPtr<BlockSection> &section : m_sections) {
+        if (section) {
+            bytes += sizeof(BlockSection) + section->memoryBytes();
+        }
+    }
+    return bytes;
+}
 
-                            float animated = 0.f;
-                            if (animatedBlocks.count(curr) > 0) {
-                                animated = 1.f;
-                            }
+uPtr<ChunkSnapshot> Chunk::snapshot() const {
+    uPtr<ChunkSnapshot> snap = mkU<ChunkSnapshot>();
+    copyBlocks(snap->blocks);
+    for (int s = 0; s < 16; s++) {
+        const BlockSection *section = m_sections[s].get();
+        snap->singleType[s] = !section || section->isSingleType();
+        snap->sectionType[s] = section ? section->get(0) : EMPTY;
+    }
+    snap->hasNeighbor.fill(false);
 
-                            vec4 tex;
-                            if (texMap.count(curr) == 0) {
-                                tex = vec4(texMap.at(OTHER).at(face.direction), 0, 0);
-                            } else {
-                                tex = vec4(texMap.at(curr).at(face.direction), 0, animated);
-                            }
+    for (const auto &entry : m_neighbors) {
+        Direction dir = entry.first;
+        const Chunk *neighbor = entry.second;
+        if (neighbor == nullptr) {
+            continue;
+        }
+        snap->hasNeighbor[dir] = true;
 
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[0]), 1));
-                            vbo.push_back(face.nor[0]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(BLK_UV, 0, 0, 0));
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[1]), 1));
-                            vbo.push_back(face.nor[1]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex);
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[2]), 1));
-                            vbo.push_back(face.nor[2]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(0, BLK_UV, 0, 0));
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[3]), 1));
-                            vbo.push_back(face.nor[3]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(BLK_UV, BLK_UV, 0, 0));
-
-                            idx.push_back(start);
-                            idx.push_back(start + 1);
-                            idx.push_back(start + 2);
-                            idx.push_back(start);
-                            idx.push_back(start + 2);
-                            idx.push_back(start + 3);
-                        }
-                    }
+        // Copy the slice of the neighbor that faces this Chunk
+        std::array<BlockType, 16 * 256> &border = snap->borders[dir];
+        for (int y = 0; y < 256; y++) {
+            for (int i = 0; i < 16; i++) {
+                switch (dir) {
+                case XPOS:
+                    border[i + 16 * y] = neighbor->getBlockAt(0, y, i);
+                    break;
+                case XNEG:
+                    border[i + 16 * y] = neighbor->getBlockAt(15, y, i);
+                    break;
+                case ZPOS:
+                    border[i + 16 * y] = neighbor->getBlockAt(i, y, 0);
+                    break;
+                case ZNEG:
+                    border[i + 16 * y] = neighbor->getBlockAt(i, y, 15);
+                    break;
+                default:
+                    break;
                 }
             }
         }
     }
+    return snap;
+}
 
-    bufferVBOdata(idx, vbo);
+// Index of the axis along which a face corner offset varies
+static int axisOf(const vec4 &offset) {
+    return offset.x != 0 ? 0 : (offset.y != 0 ? 1 : 2);
+}
+
+MeshStats& MeshStats::operator+=(const MeshStats &other) {
+    visibleFaces += other.visibleFaces;
+    hiddenFaces += other.hiddenFaces;
+    quads += other.quads;
+    vertexBytes += other.vertexBytes;
+    indexBytes += other.indexBytes;
+    return *this;
+}
+
+size_t MeshStats::totalBytes() const {
+    return vertexBytes + indexBytes;
+}
 
-    createTpVBOdata();
+// Packs one vertex into the layout described by ChunkVertex
+static ChunkVertex packVertex(ivec3 pos, Direction dir, BlockType type,
+                              ivec2 uv, unsigned int tile, bool animated) {
+    ChunkVertex v;
+    v.pos = static_cast<uint32_t>(pos.x)
+          | static_cast<uint32_t>(pos.y) << 5
+          | static_cast<uint32_t>(pos.z) << 14
+          | static_cast<uint32_t>(dir) << 19
+          | static_cast<uint32_t>(type) << 22;
+    v.tex = static_cast<uint32_t>(uv.x)
+          | static_cast<uint32_t>(uv.y) << 9
+          | static_cast<uint32_t>(tile) << 18
+          | static_cast<uint32_t>(animated) << 26;
+    return v;
 }
 
-void Chunk::bufferVBOdata(vector<int> idx, vector<vec4> vbo) {
-    m_count = idx.size();
+// Appends one quad covering the given face of the box starting at origin
+// with the given size in blocks along each axis.
+static void appendQuad(const BlockFace &face, BlockType curr, ivec3 origin, ivec3 size,
+                       vector<int> &idx, vector<ChunkVertex> &vbo) {
+    int start = vbo.size();
 
-    generateIdx();
-    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufIdx);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(int), idx.data(), GL_STATIC_DRAW);
+    bool animated = animatedBlocks.count(curr) > 0;
 
-    generateVBO();
-    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufVBO);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, vbo.size() * sizeof(vec4), vbo.data(), GL_STATIC_DRAW);
+    vec2 tile;
+    if (texMap.count(curr) == 0) {
+        tile = texMap.at(OTHER).at(face.direction) / BLK_UV;
+        animated = false;
+    } else {
+        tile = texMap.at(curr).at(face.direction) / BLK_UV;
+    }
+    unsigned int tileIdx = static_cast<unsigned int>(glm::round(tile.x) + 16.f * glm::round(tile.y));
+
+    // The texture repeats once per block, so the UVs count blocks
+    // along the two in-plane axes of the face. The shader wraps them
+    // back into the block's atlas tile.
+    ivec2 blocks = ivec2(size[axisOf(face.pos[0] - face.pos[1])],
+                         size[axisOf(face.pos[2] - face.pos[1])]);
+    static const array<ivec2, 4> cornerUVs = {ivec2(1, 0), ivec2(0, 0), ivec2(0, 1), ivec2(1, 1)};
+
+    for (int i = 0; i < 4; i++) {
+        ivec3 pos = origin + ivec3(face.pos[i]) * size;
+        vbo.push_back(packVertex(pos, face.direction, curr, cornerUVs[i] * blocks, tileIdx, animated));
+    }
+
+    idx.push_back(start);
+    idx.push_back(start + 1);
+    idx.push_back(start + 2);
+    idx.push_back(start);
+    idx.push_back(start + 2);
+    idx.push_back(start + 3);
 }
 
+SectionVisibility SectionVisibility::open() {
+    SectionVisibility vis;
+    vis.connected.fill(0x3f);
+    return vis;
+}
 
+bool SectionVisibility::connects(Direction a, Direction b) const {
+    return (connected[a] >> b) & 1;
+}
 
-void Chunk::createTpVBOdata() {
-    vector<int> idx;
-    vector<vec4> vbo;
-    /*
-     * Structure of vbo:
-     * pos0 nor0 col0
-     * pos1 nor1 col1 uv1
-     * pos2 nor2 col2 uv2
-     * etc
-     */
+// Can light (and the camera's view) pass through this block?
+static bool isSeeThrough(BlockType t) {
+    return t == EMPTY || transparentBlocks.count(t) > 0;
+}
 
+// Flood fills the see-through blocks of one section. Every group of connected
+// see-through blocks links together all of the section faces it touches.
+static SectionVisibility computeSectionVisibility(const ChunkSnapshot &snapshot, int section) {
+    SectionVisibility vis;
+    vis.connected.fill(0);
+    if (snapshot.singleType[section]) {
+        return isSeeThrough(snapshot.sectionType[section]) ? SectionVisibility::open() : vis;
+    }
+
+    std::array<bool, 4096> visited;
+    int openBlocks = 0;
+    for (int i = 0; i < 4096; i++) {
+        int x = i % 16, y = (i / 16) % 16, z = i / 256;
+        visited[i] = !isSeeThrough(snapshot.blocks[x + 16 * (y + 16 * section) + 16 * 256 * z]);
+        if (!visited[i]) {
+            openBlocks++;
+        }
+    }
+    // Skip the fill for the two most common cases: solid rock and open sky
+    if (openBlocks == 0) {
+        return vis;
+    }
+    if (openBlocks == 4096) {
+        return SectionVisibility::open();
+    }
+
+    std::vector<int> stack;
+    for (int start = 0; start < 4096; start++) {
+        if (visited[start]) {
+            continue;
+        }
+        visited[start] = true;
+        stack.push_back(start);
+        uint8_t faces = 0;
+
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            ivec3 p(i % 16, (i / 16) % 16, i / 256);
+
+            for (auto &face : neighboringFaces) {
+                ivec3 n = p + ivec3(face.dirVec);
+                if (n.x < 0 || n.x >= 16 || n.y < 0 || n.y >= 16 || n.z < 0 || n.z >= 16) {
+                    faces |= 1 << face.direction;
+                    continue;
+                }
+                int j = n.x + 16 * n.y + 256 * n.z;
+                if (!visited[j]) {
+                    visited[j] = true;
+                    stack.push_back(j);
+                }
+            }
+        }
+
+        for (int d = 0; d < 6; d++) {
+            if ((faces >> d) & 1) {
+                vis.connected[d] |= faces;
+            }
+        }
+    }
+    return vis;
+}
+
+// Is every block touching the outside of the section opaque? Then no face
+// of a solid section inside it can be seen.
+static bool isSectionEnclosed(const ChunkSnapshot &snapshot, int section) {
+    int minY = 16 * section;
+    for (int a = 0; a < 16; a++) {
+        for (int b = 0; b < 16; b++) {
+            if (isSeeThrough(snapshot.getBlockAt(a, minY - 1, b)) || isSeeThrough(snapshot.getBlockAt(a, minY + 16, b)) ||
+                isSeeThrough(snapshot.getBlockAt(-1, minY + a, b)) || isSeeThrough(snapshot.getBlockAt(16, minY + a, b)) ||
+                isSeeThrough(snapshot.getBlockAt(b, minY + a, -1)) || isSeeThrough(snapshot.getBlockAt(b, minY + a, 16))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Does the given block's face toward the neighbor need to be drawn?
+static bool isFaceVisible(BlockType curr, BlockType neighbor, bool transparent) {
+    if (curr == EMPTY || (transparentBlocks.count(curr) > 0) != transparent) {
+        return false;
+    }
+    // Translucent blocks of the same type read as one body (e.g. a lake of
+    // WATER), so only their outer shell is drawn
+    if (transparent && neighbor == curr) {
+        return false;
+    }
+    return neighbor == EMPTY || transparentBlocks.count(neighbor) > 0;
+}
+
+void Chunk::appendFaces(const ChunkSnapshot &snapshot, int section, bool transparent,
+                        vector<int> &idx, vector<ChunkVertex> &vbo, MeshStats &stats) {
     for (int z = 0; z < 16; z++) {
-        for (int y = 0; y < 256; y++) {
+        for (int y = 16 * section; y < 16 * (section + 1); y++) {
             for (int x = 0; x < 16; x++) {
-                BlockType curr = getBlockAt(x, y, z);
-                if (curr != EMPTY && transparentBlocks.count(curr) == 1) {
-                    for (auto &face : neighboringFaces) {
-                        // Set position of neighboring block
-                        vec3 neighborPos = vec3(x, y, z) + face.dirVec;
-                        BlockType neighbor;
-
-                        // Go into neighboring chunks if necessary and get neighboring block type
-                        if (neighborPos.x < 0) {
-                            Chunk* neighborChunk = m_neighbors.at(XNEG);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.x += 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.x >= 16) {
-                            Chunk* neighborChunk = m_neighbors.at(XPOS);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.x -= 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.y < 0) {
-                            neighbor = EMPTY;
-                        } else if (neighborPos.y >= 16) {
-                            neighbor = EMPTY;
-                        } else if (neighborPos.z < 0) {
-                            Chunk* neighborChunk = m_neighbors.at(ZNEG);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.z += 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else if (neighborPos.z >= 16) {
-                            Chunk* neighborChunk = m_neighbors.at(ZPOS);
-                            if (neighborChunk == nullptr) {
-                                neighbor = EMPTY;
-                            } else {
-                                neighborPos.z -= 16;
-                                neighbor = neighborChunk->getBlockAt((int) neighborPos.x,
-                                                                     (int) neighborPos.y, (int) neighborPos.z);
-                            }
-                        } else {
-                            neighbor = getBlockAt((int) neighborPos.x, (int) neighborPos.y, (int) neighborPos.z);
-                        }
-
-                        // If the neighboring block is empty, set up the VBO
-                        if (neighbor == EMPTY || transparentBlocks.count(neighbor) > 0) {
-                            int start = vbo.size() / 4;
+                BlockType curr = snapshot.blocks[x + 16 * y + 16 * 256 * z];
+                if (curr == EMPTY || (transparentBlocks.count(curr) > 0) != transparent) {
+                    continue;
+                }
+                for (auto &face : neighboringFaces) {
+                    // Set position of neighboring block
+                    ivec3 neighborPos = ivec3(x, y, z) + ivec3(face.dirVec);
+                    BlockType neighbor = snapshot.getBlockAt(neighborPos.x, neighborPos.y, neighborPos.z);
+
+                    // If the neighboring block is empty, set up the VBO
+                    if (isFaceVisible(curr, neighbor, transparent)) {
+                        appendQuad(face, curr, ivec3(x, y, z), ivec3(1), idx, vbo);
+                        stats.visibleFaces++;
+                    } else {
+                        stats.hiddenFaces++;
+                    }
+                }
+            }
+        }
+    }
+}
 
+void Chunk::appendGreedyFaces(const ChunkSnapshot &snapshot, int section, bool transparent,
+                              vector<int> &idx, vector<ChunkVertex> &vbo, MeshStats &stats) {
+    // Faces are only merged within the section, so that each section's
+    // quads can be drawn on their own
+    const ivec3 dims(16, 16, 16);
+    const ivec3 sectionOrigin(0, 16 * section, 0);
+    // The BlockType of each visible face in the current slice, or EMPTY
+    vector<BlockType> mask;
+
+    for (auto &face : neighboringFaces) {
+        ivec3 normal = ivec3(face.dirVec);
+        // n is the axis the face points along, u and v span its plane
+        int n = axisOf(vec4(face.dirVec, 0));
+        int u = axisOf(face.pos[0] - face.pos[1]);
+        int v = axisOf(face.pos[2] - face.pos[1]);
+        int dimU = dims[u];
+        int dimV = dims[v];
+        mask.assign(dimU * dimV, EMPTY);
+
+        for (int d = 0; d < dims[n]; d++) {
+            for (int b = 0; b < dimV; b++) {
+                for (int a = 0; a < dimU; a++) {
+                    ivec3 p;
+                    p[n] = d;
+                    p[u] = a;
+                    p[v] = b;
+                    p += sectionOrigin;
+                    BlockType curr = snapshot.blocks[p.x + 16 * p.y + 16 * 256 * p.z];
+                    ivec3 neighborPos = p + normal;
+                    BlockType neighbor = snapshot.getBlockAt(neighborPos.x, neighborPos.y, neighborPos.z);
+                    if (isFaceVisible(curr, neighbor, transparent)) {
+                        mask[a + dimU * b] = curr;
+                        stats.visibleFaces++;
+                    } else {
+                        mask[a + dimU * b] = EMPTY;
+                        if (curr != EMPTY && (transparentBlocks.count(curr) > 0) == transparent) {
+                            stats.hiddenFaces++;
+                        }
+                    }
+                }
+            }
 
-                            vec4 color;
-                            if (colorMap.count(curr) == 0) {
-                                color = vec4(1, 0, 1, 1);
-                            } else {
-                                color = colorMap.at(curr);
-                            }
+            // Grow each unclaimed face first along u, then along v for as long
+            // as every face in the next row matches, and emit the rectangle
+            for (int b = 0; b < dimV; b++) {
+                for (int a = 0; a < dimU;) {
+                    BlockType type = mask[a + dimU * b];
+                    if (type == EMPTY) {
+                        a++;
+                        continue;
+                    }
 
-                            float animated = 0.f;
-                            if (animatedBlocks.count(curr) > 0) {
-                                animated = 1.f;
-                            }
+                    int w = 1;
+                    while (a + w < dimU && mask[a + w + dimU * b] == type) {
+                        w++;
+                    }
 
-                            vec4 tex;
-                            if (texMap.count(curr) == 0) {
-                                tex = vec4(texMap.at(OTHER).at(face.direction), 0, 0);
-                            } else {
-                                tex = vec4(texMap.at(curr).at(face.direction), 0, animated);
+                    int h = 1;
+                    bool rowMatches = true;
+                    while (b + h < dimV && rowMatches) {
+                        for (int k = 0; k < w; k++) {
+                            if (mask[a + k + dimU * (b + h)] != type) {
+                                rowMatches = false;
+                                break;
                             }
+                        }
+                        if (rowMatches) {
+                            h++;
+                        }
+                    }
 
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[0]), 1));
-                            vbo.push_back(face.nor[0]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(BLK_UV, 0, 0, 0));
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[1]), 1));
-                            vbo.push_back(face.nor[1]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex);
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[2]), 1));
-                            vbo.push_back(face.nor[2]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(0, BLK_UV, 0, 0));
-
-                            vbo.push_back(vec4(vec3(x, y, z) + vec3(face.pos[3]), 1));
-                            vbo.push_back(face.nor[3]);
-                            vbo.push_back(color);
-                            vbo.push_back(tex + vec4(BLK_UV, BLK_UV, 0, 0));
-
-                            idx.push_back(start);
-                            idx.push_back(start + 1);
-                            idx.push_back(start + 2);
-                            idx.push_back(start);
-                            idx.push_back(start + 2);
-                            idx.push_back(start + 3);
+                    ivec3 origin;
+                    origin[n] = d;
+                    origin[u] = a;
+                    origin[v] = b;
+                    ivec3 size(1);
+                    size[u] = w;
+                    size[v] = h;
+                    appendQuad(face, type, sectionOrigin + origin, size, idx, vbo);
+
+                    for (int j = 0; j < h; j++) {
+                        for (int k = 0; k < w; k++) {
+                            mask[a + k + dimU * (b + j)] = EMPTY;
                         }
                     }
+                    a += w;
                 }
             }
         }
     }
+}
 
-    bufferTpVBOdata(idx, vbo);
+ChunkMesh Chunk::buildMesh(const ChunkSnapshot &snapshot, MeshMode mode) {
+    TRACE_SCOPE("Chunk::buildMesh");
+    ChunkMesh mesh;
+    // Both meshes are built one section at a time, bottom to top,
+    // so each section's indices form one contiguous run
+    for (int section = 0; section < 16; section++) {
+        mesh.sectionOffsets[section] = mesh.idx.size();
+        mesh.tpSectionOffsets[section] = mesh.tpIdx.size();
+
+        // Skip the 4096 blocks of sections that can't have a visible face:
+        // open air, and solid rock with nothing see-through around it
+        if (snapshot.singleType[section]) {
+            BlockType type = snapshot.sectionType[section];
+            if (type == EMPTY) {
+                mesh.visibility[section] = SectionVisibility::open();
+                continue;
+            }
+            if (!isSeeThrough(type) && isSectionEnclosed(snapshot, section)) {
+                // Every side of every block is hidden
+                mesh.stats.hiddenFaces += 6 * 4096;
+                mesh.visibility[section].connected.fill(0);
+                continue;
+            }
+        }
+
+        if (mode == GREEDY) {
+            appendGreedyFaces(snapshot, section, false, mesh.idx, mesh.vbo, mesh.stats);
+            appendGreedyFaces(snapshot, section, true, mesh.tpIdx, mesh.tpVbo, mesh.stats);
+        } else {
+            appendFaces(snapshot, section, false, mesh.idx, mesh.vbo, mesh.stats);
+            appendFaces(snapshot, section, true, mesh.tpIdx, mesh.tpVbo, mesh.stats);
+        }
+        mesh.visibility[section] = computeSectionVisibility(snapshot, section);
+    }
+    mesh.sectionOffsets[16] = mesh.idx.size();
+    mesh.tpSectionOffsets[16] = mesh.tpIdx.size();
+
+    mesh.stats.quads = (mesh.idx.size() + mesh.tpIdx.size()) / 6;
+    mesh.stats.vertexBytes = (mesh.vbo.size() + mesh.tpVbo.size()) * sizeof(ChunkVertex);
+    mesh.stats.indexBytes = (mesh.idx.size() + mesh.tpIdx.size()) * sizeof(int);
+
+    if (!mesh.vbo.empty() || !mesh.tpVbo.empty()) {
+        mesh.minY = 256;
+        mesh.maxY = 0;
+        for (const vector<ChunkVertex> *vbo : {&mesh.vbo, &mesh.tpVbo}) {
+            for (const ChunkVertex &v : *vbo) {
+                int y = (v.pos >> 5) & 511;
+                mesh.minY = std::min(mesh.minY, y);
+                mesh.maxY = std::max(mesh.maxY, y);
+            }
+        }
+    }
+    return mesh;
+}
+
+const MeshStats& Chunk::getMeshStats() const {
+    return m_meshStats;
+}
+
+const std::array<int, 17>& Chunk::getSectionOffsets(bool transparent) const {
+    return transparent ? m_tpSectionOffsets : m_sectionOffsets;
 }
 
-void Chunk::bufferTpVBOdata(vector<int> idx, vector<vec4> vbo) {
-    m_tpCount = idx.size();
+const SectionVisibility& Chunk::getSectionVisibility(int section) const {
+    return m_sectionVisibility[section];
+}
+
+bool Chunk::hasGeometry() const {
+    return m_allocation.indexCount > 0 || m_allocation.tpIndexCount > 0;
+}
+
+glm::vec3 Chunk::getBoundsMin() const {
+    return glm::vec3(minX, m_meshMinY, minZ);
+}
 
-    generateTpIdx();
-    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_bufTpIdx);
-    mp_context->glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(int), idx.data(), GL_STATIC_DRAW);
+glm::vec3 Chunk::getBoundsMax() const {
+    return glm::vec3(minX + 16, m_meshMaxY, minZ + 16);
+}
+
+void Chunk::setMesh(const ChunkMesh &mesh, const ChunkAllocation &allocation) {
+    m_meshStats = mesh.stats;
+    m_meshMinY = mesh.minY;
+    m_meshMaxY = mesh.maxY;
+    m_sectionOffsets = mesh.sectionOffsets;
+    m_tpSectionOffsets = mesh.tpSectionOffsets;
+    m_sectionVisibility = mesh.visibility;
+    m_allocation = allocation;
+}
+
+bool Chunk::hasMesh() const {
+    return m_allocation.uploaded();
+}
 
-    generateTpVBO();
-    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_bufTpVBO);
-    mp_context->glBufferData(GL_ARRAY_BUFFER, vbo.size() * sizeof(vec4), vbo.data(), GL_STATIC_DRAW);
+const ChunkAllocation& Chunk::getAllocation() const {
+    return m_allocation;
 }
@@ -1,15 +1,115 @@
 ﻿#pragma once
-#include "drawable.h"
 #include "smartpointerhelp.h"
+#include "arenahandle.h"
 #include "glm_includes.h"
 #include <array>
 #include <unordered_map>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
 #include "chunkhelpers.h"
+#include "blocksection.h"
 
 using namespace std;
 using namespace glm;
 
+// A read-only copy of everything the mesher needs to know about a Chunk:
+// its own blocks, plus the one-block-thick slice of each of its four
+// neighbors that touches it. Taking one of these on the main thread lets
+// the mesh be built on a worker thread while the live Chunk keeps changing.
+struct ChunkSnapshot {
+    std::array<BlockType, 65536> blocks;
+    // Indexed by Direction; only XPOS, XNEG, ZPOS and ZNEG are used.
+    // Each slice is 16 wide (along the shared edge) by 256 tall.
+    std::array<std::array<BlockType, 16 * 256>, 6> borders;
+    std::array<bool, 6> hasNeighbor;
+    // Whether each 16-block-tall section was stored as a single type, and
+    // which, so the mesher can skip the ones with nothing to draw
+    std::array<bool, 16> singleType;
+    std::array<BlockType, 16> sectionType;
+
+    // Takes coordinates relative to the snapshotted Chunk, which may lie
+    // one block outside of it on the x-z plane. Anything with no data
+    // (no neighbor Chunk, or outside the world) reads as EMPTY.
+    BlockType getBlockAt(int x, int y, int z) const;
+};
+
+// One vertex of a Chunk mesh, packed into two 32-bit words and unpacked by
+// lambert.vert.glsl. Bits are listed from least significant up.
+// pos: x (5 bits), y (9), z (5) relative to the Chunk's corner,
+//      the face's Direction (3) and the BlockType (8)
+// tex: u (9 bits), v (9) counting blocks across the quad, the block's tile
+//      in the 16 x 16 texture atlas (8) and whether it is animated (1)
+// The normal and color are looked up in the shader from the Direction and
+// BlockType, so they need no space of their own.
+struct ChunkVertex {
+    uint32_t pos;
+    uint32_t tex;
+};
+
+// Which faces of a 16 x 16 x 16 section of a Chunk can see each other
+// through the section's see-through (EMPTY or transparent) blocks.
+// Used to cull sections that are hidden behind solid terrain.
+struct SectionVisibility {
+    // Bit b of connected[a] is set when faces a and b (as Directions) are connected
+    std::array<uint8_t, 6> connected;
+
+    // A section that every face can see through
+    static SectionVisibility open();
+    bool connects(Direction a, Direction b) const;
+};
+
+// How much work a Chunk's meshes do, for judging how well faces are culled
+// and merged. "Faces" are single block faces, however they end up merged
+// into quads.
+struct MeshStats {
+    // Block faces that can be seen, and so are covered by some quad
+    unsigned int visibleFaces = 0;
+    // Block faces that were skipped because their neighbor hides them
+    unsigned int hiddenFaces = 0;
+    // Quads actually emitted; less than visibleFaces when greedy meshing
+    unsigned int quads = 0;
+    // Size of the vertex and index buffers uploaded to the GPU
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+
+    MeshStats& operator+=(const MeshStats &other);
+    size_t totalBytes() const;
+};
+
+// The CPU-side vertex and index data of a Chunk's opaque and transparent
+// meshes, in the interleaved layout consumed by ChunkRenderer.
+struct ChunkMesh {
+    std::vector<int> idx;
+    std::vector<ChunkVertex> vbo;
+    std::vector<int> tpIdx;
+    std::vector<ChunkVertex> tpVbo;
+    MeshStats stats;
+    // The range of y covered by either mesh's vertices
+    int minY = 0;
+    int maxY = 0;
+    // Section s's quads are indices [offsets[s], offsets[s + 1]) of idx (or tpIdx)
+    std::array<int, 17> sectionOffsets;
+    std::array<int, 17> tpSectionOffsets;
+    std::array<SectionVisibility, 16> visibility;
+};
+
+// Where a Chunk's uploaded meshes live within ChunkRenderer's shared
+// buffers. Both meshes share one range of vertices and one range of
+// indices, with the opaque mesh's data first.
+struct ChunkAllocation {
+    ArenaHandle vertices = INVALID_ARENA_HANDLE;
+    ArenaHandle indices = INVALID_ARENA_HANDLE;
+    // How many vertices and indices belong to the opaque mesh
+    int vertexCount = 0;
+    int indexCount = 0;
+    // And to the transparent one
+    int tpVertexCount = 0;
+    int tpIndexCount = 0;
+
+    bool uploaded() const;
+};
+
 // One Chunk is a 16 x 256 x 16 section of the world,
 // containing all the Minecraft blocks in that area.
 // We divide the world into Chunks in order to make
@@ -17,28 +117,99 @@ using namespace glm;
 // render all the world at once, while also not having
 // to render the world block by block.
 
-// Chunk inherits from Drawable
-class Chunk : public Drawable {
+class Chunk {
 private:
-    // All of the blocks contained within this Chunk
-    std::array<BlockType, 65536> m_blocks;
+    // All of the blocks contained within this Chunk, in 16-block-tall
+    // sections from the bottom up. Sections that are all EMPTY, like the
+    // sky above the terrain, are null rather than allocated.
+    std::array<uPtr<BlockSection>, 16> m_sections;
     int minX, minZ;
     // This Chunk's four neighbors to the north, south, east, and west
     // The third input to this map just lets us use a Direction as
     // a key for this map.
     // These allow us to properly determine
     std::unordered_map<Direction, Chunk*, EnumHash> m_neighbors;
-    array<BlockFace, 6> neighboringFaces;
+    // Statistics of the mesh most recently passed to setMesh
+    MeshStats m_meshStats;
+    // The y range that mesh occupies, for a bounding box tighter than the full 256 blocks
+    int m_meshMinY, m_meshMaxY;
+    // Per-section index ranges and connectivity of that mesh, see ChunkMesh
+    std::array<int, 17> m_sectionOffsets;
+    std::array<int, 17> m_tpSectionOffsets;
+    std::array<SectionVisibility, 16> m_sectionVisibility;
+    // Where that mesh is stored on the GPU
+    ChunkAllocation m_allocation;
+    // Have the blocks changed since they were last saved or loaded?
+    bool m_modified;
+
+    // Appends a face for every visible side of every block in the given
+    // 16-block-tall section that is (or is not) transparent, depending
+    // on the transparent flag.
+    static void appendFaces(const ChunkSnapshot &snapshot, int section, bool transparent,
+                            std::vector<int> &idx, std::vector<ChunkVertex> &vbo, MeshStats &stats);
+    // Same as appendFaces, but merges each slice's visible faces of the same
+    // BlockType into as few rectangles as it can.
+    static void appendGreedyFaces(const ChunkSnapshot &snapshot, int section, bool transparent,
+                                  std::vector<int> &idx, std::vector<ChunkVertex> &vbo, MeshStats &stats);
+    // Unpacks every block into (or packs every block from) the dense
+    // x + 16 * y + 16 * 256 * z order used by snapshots and saved Chunks
+    void copyBlocks(std::array<BlockType, 65536> &blocks) const;
+    void assignBlocks(const std::array<BlockType, 65536> &blocks);
 
 public:
-    Chunk(OpenGLContext* context, int x, int y);
+    Chunk(int x, int y);
+    // World-space coordinates of this Chunk's lower-left corner
+    int getMinX() const;
+    int getMinZ() const;
     BlockType getBlockAt(unsigned int x, unsigned int y, unsigned int z) const;
     BlockType getBlockAt(int x, int y, int z) const;
     void setBlockAt(unsigned int x, unsigned int y, unsigned int z, BlockType t);
+    // Shrinks the storage of every section to what its blocks need now,
+    // releasing any that are all EMPTY. Worth calling after filling in a
+    // Chunk block by block.
+    void compactBlocks();
+    // The blocks of the given 16-block-tall section, or null if it is all EMPTY
+    const BlockSection* getSection(int section) const;
     void linkNeighbor(uPtr<Chunk>& neighbor, Direction dir);
-    void createVBOdata() override;
-    void bufferVBOdata(std::vector<int> idx, std::vector<glm::vec4> vbo);
+    // Clears the pointers between this Chunk and each of its neighbors,
+    // so that it can be destroyed without leaving them dangling
+    void unlinkNeighbors();
+    // CPU memory held by the Chunk and its blocks, not counting its mesh
+    size_t memoryBytes() const;
+
+    // Run-length encodes the blocks for saving to disk, as a series of
+    // (BlockType, run length - 1 in two little-endian bytes) triples
+    // in storage order. Mostly-air Chunks shrink to a few kilobytes.
+    std::vector<uint8_t> serializeBlocks() const;
+    // Replaces the blocks with the bytes bytes of data encoded by
+    // serializeBlocks() and marks the Chunk as unmodified. Returns false,
+    // leaving the blocks as they were, if they don't decode to exactly one
+    // Chunk's worth. Only reads data, so it may point into a mapped file.
+    bool deserializeBlocks(const uint8_t *data, size_t bytes);
+    // True from construction and after any setBlockAt() until the blocks
+    // are saved (see markSaved()) or loaded
+    bool isModified() const;
+    void markSaved();
 
-    void createTpVBOdata();
-    void bufferTpVBOdata(std::vector<int> idx, std::vector<glm::vec4> vbo);
+    // Copies this Chunk's blocks and its neighbors' borders.
+    // Must be called from the thread that owns the Terrain.
+    uPtr<ChunkSnapshot> snapshot() const;
+    // Builds both meshes of a snapshotted Chunk. Touches no GL or
+    // Terrain state, so it may run on any thread.
+    static ChunkMesh buildMesh(const ChunkSnapshot &snapshot, MeshMode mode = GREEDY);
+    // Records a built mesh's layout and where ChunkRenderer::upload put it,
+    // replacing any previous one
+    void setMesh(const ChunkMesh &mesh, const ChunkAllocation &allocation);
+    // Has a mesh been uploaded yet?
+    bool hasMesh() const;
+    const ChunkAllocation& getAllocation() const;
+    const MeshStats& getMeshStats() const;
+    // Index ranges of each section within the opaque or transparent mesh
+    const std::array<int, 17>& getSectionOffsets(bool transparent) const;
+    const SectionVisibility& getSectionVisibility(int section) const;
+    // Does the uploaded mesh have any faces at all?
+    bool hasGeometry() const;
+    // World-space corners of the box around this Chunk's uploaded mesh
+    glm::vec3 getBoundsMin() const;
+    glm::vec3 getBoundsMax() const;
 };
@@ -31,6 +31,13 @@ enum Direction : unsigned char
     XPOS, XNEG, YPOS, YNEG, ZPOS, ZNEG
 };
 
+// How Chunk::buildMesh turns visible block faces into quads
+enum MeshMode : unsigned char
+{
+    PER_FACE, // One quad per visible block face
+    GREEDY    // Adjacent coplanar faces of the same block type are merged into larger quads
+};
+
 // Block face data
 struct BlockFace {
     Direction direction;
@@ -0,0 +1,243 @@
+#include "chunkrenderer.h"
+#include "tracer.h"
+
+// Starting sizes of the shared buffers. They compact or double whenever they run out.
+static const size_t INITIAL_VERTEX_BYTES = 16 * 1024 * 1024;
+static const size_t INITIAL_INDEX_BYTES = 16 * 1024 * 1024;
+// See ArenaStats::fragmentation()
+static const float MAX_FRAGMENTATION = 0.5f;
+
+ChunkRenderer::ChunkRenderer(OpenGLContext* context)
+    : m_vertices(context, sizeof(ChunkVertex), "Chunk vertex arena"),
+      m_indices(context, sizeof(GLuint), "Chunk index arena"),
+      m_originBuffer(), m_commandBuffer(), m_created(false),
+      m_vao(), m_vaoVertexGeneration(-1), m_vaoIndexGeneration(-1), m_vaoAttrPacked(-1), m_vaoAttrChunkOrigin(-1),
+      m_opaque(), m_transparent(), m_multiDrawElementsIndirect(nullptr),
+      mp_context(context)
+{}
+
+void ChunkRenderer::create()
+{
+    if (m_created) {
+        return;
+    }
+    m_vertices.create(INITIAL_VERTEX_BYTES);
+    m_indices.create(INITIAL_INDEX_BYTES);
+    mp_context->glGenBuffers(1, &m_originBuffer);
+    mp_context->glGenBuffers(1, &m_commandBuffer);
+    mp_context->glGenVertexArrays(1, &m_vao);
+    // Objects only exist (and so can only be labelled) once they are first bound
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_originBuffer);
+    mp_context->labelObject(GL_BUFFER, m_originBuffer, "Chunk origins");
+    mp_context->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    mp_context->labelObject(GL_BUFFER, m_commandBuffer, "Chunk draw commands");
+    m_vaoVertexGeneration = m_vaoIndexGeneration = -1;
+    m_created = true;
+
+    // Multi-draw indirect is core in 4.3. Each command's baseInstance picks
+    // the section's origin, and is only honoured from 4.2 or with
+    // ARB_base_instance; without it every section would draw at one origin.
+    QOpenGLContext *ctx = mp_context->context();
+    QSurfaceFormat format = ctx->format();
+    auto atLeast = [&format](int major, int minor) {
+        return format.majorVersion() > major || (format.majorVersion() == major && format.minorVersion() >= minor);
+    };
+    bool supported = (atLeast(4, 3) || ctx->hasExtension("GL_ARB_multi_draw_indirect")) &&
+                     (atLeast(4, 2) || ctx->hasExtension("GL_ARB_base_instance"));
+    m_multiDrawElementsIndirect = supported
+            ? reinterpret_cast<MultiDrawElementsIndirectFn>(ctx->getProcAddress("glMultiDrawElementsIndirect"))
+            : nullptr;
+}
+
+void ChunkRenderer::destroy()
+{
+    if (!m_created) {
+        return;
+    }
+    m_vertices.destroy();
+    m_indices.destroy();
+    mp_context->glDeleteBuffers(1, &m_originBuffer);
+    mp_context->glDeleteBuffers(1, &m_commandBuffer);
+    mp_context->glDeleteVertexArrays(1, &m_vao);
+    m_created = false;
+}
+
+ChunkAllocation ChunkRenderer::upload(const ChunkMesh &mesh, const ChunkAllocation &previous)
+{
+    TRACE_SCOPE("ChunkRenderer::upload");
+    ChunkAllocation old = previous;
+    release(old);
+
+    ChunkAllocation allocation;
+    allocation.vertexCount = mesh.vbo.size();
+    allocation.indexCount = mesh.idx.size();
+    allocation.tpVertexCount = mesh.tpVbo.size();
+    allocation.tpIndexCount = mesh.tpIdx.size();
+
+    size_t opaqueVertexBytes = mesh.vbo.size() * sizeof(ChunkVertex);
+    size_t tpVertexBytes = mesh.tpVbo.size() * sizeof(ChunkVertex);
+    allocation.vertices = m_vertices.allocate(opaqueVertexBytes + tpVertexBytes);
+    m_vertices.write(allocation.vertices, 0, mesh.vbo.data(), opaqueVertexBytes);
+    m_vertices.write(allocation.vertices, opaqueVertexBytes, mesh.tpVbo.data(), tpVertexBytes);
+
+    size_t opaqueIndexBytes = mesh.idx.size() * sizeof(GLuint);
+    size_t tpIndexBytes = mesh.tpIdx.size() * sizeof(GLuint);
+    allocation.indices = m_indices.allocate(opaqueIndexBytes + tpIndexBytes);
+    m_indices.write(allocation.indices, 0, mesh.idx.data(), opaqueIndexBytes);
+    m_indices.write(allocation.indices, opaqueIndexBytes, mesh.tpIdx.data(), tpIndexBytes);
+
+    return allocation;
+}
+
+void ChunkRenderer::release(ChunkAllocation &allocation)
+{
+    if (allocation.uploaded() && m_created) {
+        m_vertices.release(allocation.vertices);
+        m_indices.release(allocation.indices);
+    }
+    allocation = ChunkAllocation();
+}
+
+void ChunkRenderer::queue(const ChunkAllocation &allocation, glm::vec3 origin, bool transparent, int first, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    // Both meshes' indices count from the start of their own vertices, so
+    // the transparent mesh's base vertex skips past the opaque vertices.
+    // Offsets are looked up now since uploads may have moved the ranges.
+    GLuint firstIndex = m_indices.offsetOf(allocation.indices) / sizeof(GLuint) + first;
+    GLint baseVertex = m_vertices.offsetOf(allocation.vertices) / sizeof(ChunkVertex);
+    if (transparent) {
+        firstIndex += allocation.indexCount;
+        baseVertex += allocation.vertexCount;
+    }
+
+    Batch &batch = transparent ? m_transparent : m_opaque;
+    GLuint instance = batch.origins.size();
+    batch.commands.push_back({static_cast<GLuint>(count), 1, firstIndex, baseVertex, instance});
+    batch.origins.push_back(glm::vec4(origin, 0.f));
+}
+
+void ChunkRenderer::defragment()
+{
+    for (BufferArena *arena : {&m_vertices, &m_indices}) {
+        ArenaStats stats = arena->stats();
+        // Only worth a full copy when a sizeable share of the buffer is
+        // free but the largest piece of it is under half of that
+        if (4 * stats.freeBytes > stats.capacity && stats.fragmentation() > MAX_FRAGMENTATION) {
+            arena->compact();
+        }
+    }
+}
+
+int ChunkRenderer::draw(ShaderProgram &prog, GpuProfiler *profiler)
+{
+    int drawCalls = 0;
+    if (m_created) {
+        {
+            GpuProfiler::Scope timer(profiler, OPAQUE_PASS);
+            drawCalls += drawBatch(prog, m_opaque);
+        }
+        {
+            GpuProfiler::Scope timer(profiler, TRANSPARENT_PASS);
+            drawCalls += drawBatch(prog, m_transparent);
+        }
+    }
+    m_opaque = Batch();
+    m_transparent = Batch();
+    mp_context->glBindVertexArray(0);
+    return drawCalls;
+}
+
+void ChunkRenderer::bindVAO(const ShaderProgram &prog)
+{
+    mp_context->glBindVertexArray(m_vao);
+    if (m_vaoVertexGeneration < 0) {
+        mp_context->labelObject(GL_VERTEX_ARRAY, m_vao, "Chunk VAO");
+    }
+
+    if (m_vaoVertexGeneration == m_vertices.generation() && m_vaoIndexGeneration == m_indices.generation() &&
+        m_vaoAttrPacked == prog.attrPacked && m_vaoAttrChunkOrigin == prog.attrChunkOrigin) {
+        return;
+    }
+
+    // Each vertex is a ChunkVertex: two unsigned ints that the
+    // vertex shader unpacks, so they must not be converted to floats
+    if (m_vaoAttrPacked != -1) mp_context->glDisableVertexAttribArray(m_vaoAttrPacked);
+    mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_vertices.buffer());
+    if (prog.attrPacked != -1) {
+        mp_context->glEnableVertexAttribArray(prog.attrPacked);
+        mp_context->glVertexAttribIPointer(prog.attrPacked, 2, GL_UNSIGNED_INT, sizeof(ChunkVertex), (void*)0);
+    }
+
+    // One origin per command, stepped through once per instance so
+    // that each command's baseInstance picks out its own. Without
+    // multi-draw indirect the array stays disabled and the origin is
+    // set as the attribute's current value between draws instead.
+    if (m_vaoAttrChunkOrigin != -1) mp_context->glDisableVertexAttribArray(m_vaoAttrChunkOrigin);
+    if (prog.attrChunkOrigin != -1 && m_multiDrawElementsIndirect) {
+        mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_originBuffer);
+        mp_context->glEnableVertexAttribArray(prog.attrChunkOrigin);
+        mp_context->glVertexAttribPointer(prog.attrChunkOrigin, 4, GL_FLOAT, false, sizeof(glm::vec4), (void*)0);
+        mp_context->glVertexAttribDivisor(prog.attrChunkOrigin, 1);
+    }
+
+    mp_context->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices.buffer());
+
+    m_vaoVertexGeneration = m_vertices.generation();
+    m_vaoIndexGeneration = m_indices.generation();
+    m_vaoAttrPacked = prog.attrPacked;
+    m_vaoAttrChunkOrigin = prog.attrChunkOrigin;
+}
+
+int ChunkRenderer::drawBatch(ShaderProgram &prog, const Batch &batch)
+{
+    if (batch.commands.empty()) {
+        return 0;
+    }
+    prog.useMe();
+    bindVAO(prog);
+
+    int drawCalls = 0;
+    if (m_multiDrawElementsIndirect) {
+        // The VAO already points at these buffers; only their contents change
+        mp_context->glBindBuffer(GL_ARRAY_BUFFER, m_originBuffer);
+        mp_context->glBufferData(GL_ARRAY_BUFFER, batch.origins.size() * sizeof(glm::vec4),
+                                 batch.origins.data(), GL_STREAM_DRAW);
+        mp_context->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        mp_context->glBufferData(GL_DRAW_INDIRECT_BUFFER, batch.commands.size() * sizeof(DrawCommand),
+                                 batch.commands.data(), GL_STREAM_DRAW);
+        m_multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, batch.commands.size(), 0);
+        drawCalls = 1;
+    } else {
+        for (size_t i = 0; i < batch.commands.size(); i++) {
+            const DrawCommand &command = batch.commands[i];
+            if (prog.attrChunkOrigin != -1) {
+                mp_context->glVertexAttrib4fv(prog.attrChunkOrigin, &batch.origins[i][0]);
+            }
+            mp_context->glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                                 (void*)(command.firstIndex * sizeof(GLuint)), command.baseVertex);
+        }
+        drawCalls = batch.commands.size();
+    }
+
+    mp_context->printGLErrorLog();
+    return drawCalls;
+}
+
+bool ChunkRenderer::usesMultiDrawIndirect() const
+{
+    return m_multiDrawElementsIndirect != nullptr;
+}
+
+ArenaStats ChunkRenderer::vertexStats() const
+{
+    return m_vertices.stats();
+}
+
+ArenaStats ChunkRenderer::indexStats() const
+{
+    return m_indices.stats();
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "bufferarena.h"
+#include "chunk.h"
+#include "shaderprogram.h"
+#include "gpuprofiler.h"
+#include "glm_includes.h"
+#include <vector>
+
+// Owns the GPU storage of every Chunk mesh and draws them in batches.
+// All Chunks' vertices live in one shared vertex buffer and all their
+// indices in one shared index buffer, so a whole pass of visible sections
+// can be submitted with a single glMultiDrawElementsIndirect call. Each
+// draw's Chunk origin comes from a per-instance vertex attribute selected
+// by its baseInstance rather than from a uniform set between draws.
+// Where multi-draw indirect is unavailable (GL < 4.3 without
+// ARB_multi_draw_indirect, e.g. macOS) the same commands are issued one
+// glDrawElementsBaseVertex at a time instead.
+// The attribute setup for those buffers lives in a VAO of the renderer's
+// own, which is only re-specified when an arena replaces its buffer, so
+// drawing a pass just binds it and issues the draw.
+class ChunkRenderer {
+private:
+    // The layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+    // The draws queued for one pass, and the origin of each one's Chunk
+    struct Batch {
+        std::vector<DrawCommand> commands;
+        std::vector<glm::vec4> origins;
+    };
+
+    typedef void (QOPENGLF_APIENTRYP MultiDrawElementsIndirectFn)(GLenum mode, GLenum type, const void *indirect,
+                                                                  GLsizei drawcount, GLsizei stride);
+
+    BufferArena m_vertices;
+    BufferArena m_indices;
+    // Per-draw Chunk origins and the indirect draw commands, refilled every pass
+    GLuint m_originBuffer;
+    GLuint m_commandBuffer;
+    bool m_created;
+
+    // Points at the arenas' current buffers and the origin buffer
+    GLuint m_vao;
+    // What m_vao was last configured for: the arenas' buffer generations
+    // and the program's attribute locations. -1 when never configured.
+    long long m_vaoVertexGeneration;
+    long long m_vaoIndexGeneration;
+    int m_vaoAttrPacked;
+    int m_vaoAttrChunkOrigin;
+
+    Batch m_opaque;
+    Batch m_transparent;
+
+    // Null when multi-draw indirect is not supported
+    MultiDrawElementsIndirectFn m_multiDrawElementsIndirect;
+
+    OpenGLContext* mp_context;
+
+    // Binds m_vao, first re-specifying its attributes if the arenas'
+    // buffers or the program's attribute locations have changed
+    void bindVAO(const ShaderProgram &prog);
+    // Submits every queued command of one batch. Returns the number of
+    // GL draw calls it took.
+    int drawBatch(ShaderProgram &prog, const Batch &batch);
+
+public:
+    ChunkRenderer(OpenGLContext* context);
+
+    // Creates the shared buffers and looks up the multi-draw entry point.
+    // GL thread only.
+    void create();
+    // Frees every buffer, including all Chunks' meshes. GL thread only.
+    void destroy();
+
+    // Copies a built mesh into the shared buffers, releasing the space of the
+    // previous allocation first. Returns handles to where the mesh now lives.
+    ChunkAllocation upload(const ChunkMesh &mesh, const ChunkAllocation &previous);
+    // Returns an allocation's space to the shared buffers
+    void release(ChunkAllocation &allocation);
+    // Compacts either shared buffer whose free space has splintered into
+    // pieces too small to reuse. Cheap to call when there is nothing to do.
+    void defragment();
+
+    // Queues count indices starting at index first of one of a Chunk's
+    // meshes, to be drawn at origin by the next draw()
+    void queue(const ChunkAllocation &allocation, glm::vec3 origin, bool transparent, int first, int count);
+    // Draws everything queued since the last call, opaque draws first,
+    // and empties the queues. Returns the number of GL draw calls issued.
+    // Leaves no VAO bound, so callers must rebind their own. Each pass is
+    // timed by profiler when one is given.
+    int draw(ShaderProgram &prog, GpuProfiler *profiler = nullptr);
+
+    bool usesMultiDrawIndirect() const;
+    // Occupancy of the shared vertex and index buffers
+    ArenaStats vertexStats() const;
+    ArenaStats indexStats() const;
+};
@@ -0,0 +1,30 @@
+#include "frustum.h"
+
+Frustum::Frustum(const glm::mat4 &viewProj)
+    : m_planes()
+{
+    // Gribb-Hartmann extraction: each clip plane is the fourth row of the
+    // matrix plus or minus one of the other rows. GLM matrices are
+    // column-major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+    glm::mat4 t = glm::transpose(viewProj);
+    m_planes[0] = t[3] + t[0]; // Left
+    m_planes[1] = t[3] - t[0]; // Right
+    m_planes[2] = t[3] + t[1]; // Bottom
+    m_planes[3] = t[3] - t[1]; // Top
+    m_planes[4] = t[3] + t[2]; // Near
+    m_planes[5] = t[3] - t[2]; // Far
+}
+
+bool Frustum::intersectsAABB(const glm::vec3 &min, const glm::vec3 &max) const {
+    for (const glm::vec4 &plane : m_planes) {
+        // Test the corner of the box furthest along the plane's normal.
+        // If even that corner is behind the plane, the whole box is.
+        glm::vec3 corner(plane.x >= 0 ? max.x : min.x,
+                         plane.y >= 0 ? max.y : min.y,
+                         plane.z >= 0 ? max.z : min.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0) {
+            return false;
+        }
+    }
+    return true;
+}
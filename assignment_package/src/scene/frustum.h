@@ -0,0 +1,20 @@
+#pragma once
+#include "glm_includes.h"
+#include <array>
+
+// The six planes bounding a camera's view volume, extracted from its
+// combined projection * view matrix. Used to skip geometry that cannot
+// appear on screen.
+class Frustum {
+private:
+    // Each plane is (a, b, c, d) with the normal (a, b, c) pointing into
+    // the frustum, so a point p is inside when dot(abc, p) + d >= 0
+    std::array<glm::vec4, 6> m_planes;
+
+public:
+    Frustum(const glm::mat4 &viewProj);
+
+    // Could any part of the world-space box from min to max be visible?
+    // Conservative: may return true for some boxes just outside a corner.
+    bool intersectsAABB(const glm::vec3 &min, const glm::vec3 &max) const;
+};
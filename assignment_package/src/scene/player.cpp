@@ -1,11 +1,14 @@
 #include "player.h"
+#include "tracer.h"
 #include <QString>
 #include <iostream>
 #include <ostream>
 
 Player::Player(glm::vec3 pos, const Terrain &terrain)
     : Entity(pos), m_velocity(0,0,0), m_acceleration(0,0,0),
-      m_camera(pos + glm::vec3(0, 1.5f, 0)), mcr_terrain(terrain),
+      m_camera(pos + glm::vec3(0, 1.5f, 0)),
+      m_prevPosition(pos), m_prevCameraPosition(pos + glm::vec3(0, 1.5f, 0)),
+      m_prevCameraOrientation(orientationOf(m_camera)), mcr_terrain(terrain),
       flightMode(true), flightModeSet(false),
       huggingWall{{false, false, false, false, false, false}},
       mcr_camera(m_camera)
@@ -15,10 +18,36 @@ Player::~Player()
 {}
 
 void Player::tick(float dT, InputBundle &input) {
+    TRACE_SCOPE("Player::tick");
+    savePreviousState();
     processInputs(input);
     computePhysics(dT, mcr_terrain);
 }
 
+void Player::savePreviousState() {
+    m_prevPosition = m_position;
+    m_prevCameraPosition = m_camera.m_position;
+    m_prevCameraOrientation = orientationOf(m_camera);
+}
+
+glm::quat Player::orientationOf(const Camera &camera) {
+    return glm::quat_cast(glm::mat3(camera.m_right, camera.m_up, -camera.m_forward));
+}
+
+glm::vec3 Player::interpolatedPosition(float alpha) const {
+    return glm::mix(m_prevPosition, m_position, alpha);
+}
+
+Camera Player::interpolatedCamera(float alpha) const {
+    Camera camera(m_camera);
+    camera.m_position = glm::mix(m_prevCameraPosition, m_camera.m_position, alpha);
+    glm::mat3 basis = glm::mat3_cast(glm::slerp(m_prevCameraOrientation, orientationOf(m_camera), alpha));
+    camera.m_right = basis[0];
+    camera.m_up = basis[1];
+    camera.m_forward = -basis[2];
+    return camera;
+}
+
 void Player::processInputs(InputBundle &inputs) {
     m_acceleration = glm::vec3(0.f, 0.f, 0.f);
 
@@ -72,6 +101,7 @@ void Player::computePhysics(float dT, const Terrain &terrain) {
 }
 
 void Player::handleCollision(const Terrain& terrain) {
+    TRACE_SCOPE("Player::handleCollision");
     std::array<glm::vec3, 12> vertices = getCollisionVertices();
 
     // one ray per cardinal direction
@@ -363,25 +393,7 @@ void Player::removeBlock(Terrain &terrain) {
 
     if(terrain.getBlockAt(blockHit.x,blockHit.y,blockHit.z) != BEDROCK)
     {
+        // Terrain takes care of remeshing the affected Chunks
         terrain.setBlockAt(blockHit.x, blockHit.y, blockHit.z, EMPTY);
-        terrain.getChunkAt(blockHit.x,blockHit.z)->createVBOdata();
-        switch(blockHit.x%16)
-        {
-        case 0:
-            terrain.getChunkAt(blockHit.x-1,blockHit.z)->createVBOdata();
-            break;
-        case 15:
-            terrain.getChunkAt(blockHit.x+1,blockHit.z)->createVBOdata();
-            break;
-        }
-        switch(blockHit.z%16)
-        {
-        case 0:
-            terrain.getChunkAt(blockHit.x,blockHit.z-1)->createVBOdata();
-            break;
-        case 15:
-            terrain.getChunkAt(blockHit.x,blockHit.z+1)->createVBOdata();
-            break;
-        }
     }
 }
@@ -2,11 +2,20 @@
 #include "entity.h"
 #include "camera.h"
 #include "terrain.h"
+#include <glm/gtc/quaternion.hpp>
 
 class Player : public Entity {
 private:
+    // Blocks moved per step. Both are damped and integrated once per
+    // tick(), so the Player must be ticked at a fixed dT (see MyGL::tick())
+    // for its motion not to depend on the frame rate.
     glm::vec3 m_velocity, m_acceleration;
     Camera m_camera;
+    // Where the Player and its camera were, and which way the camera
+    // faced, before the latest step, for drawing frames that fall between
+    // two steps
+    glm::vec3 m_prevPosition, m_prevCameraPosition;
+    glm::quat m_prevCameraOrientation;
     const Terrain &mcr_terrain;
 
     bool flightMode;
@@ -22,11 +31,13 @@ private:
     void computePhysics(float dT, const Terrain &terrain);
 
     void handleCollision(const Terrain& terrain);
-    bool gridMarch(glm::vec3 rayOrigin, glm::vec3 rayDirection, const Terrain& terrain,
-                   bool huggingWall, float* out_dist, glm::ivec3* out_BlockHit);
 
     std::array<glm::vec3, 12> getCollisionVertices();
 
+    // The rotation taking the default basis (looking down -Z with +Y up)
+    // to the camera's
+    static glm::quat orientationOf(const Camera &camera);
+
 public:
     // Readonly public reference to our camera
     // for easy access from MyGL
@@ -35,9 +46,24 @@ public:
     Player(glm::vec3 pos, const Terrain &terrain);
     virtual ~Player() override;
 
+    // Steps along the ray cell by cell for at most its length, and reports
+    // the first non-EMPTY block it enters and the distance to it. Uses no
+    // Player state, so the microbenchmarks can time it on its own.
+    static bool gridMarch(glm::vec3 rayOrigin, glm::vec3 rayDirection, const Terrain& terrain,
+                          bool huggingWall, float* out_dist, glm::ivec3* out_BlockHit);
+
     void setCameraWidthHeight(unsigned int w, unsigned int h);
 
     void tick(float dT, InputBundle &input) override;
+    // Makes the current position the one interpolated from, as tick()
+    // does. For steps in which the Player is held still instead of ticked.
+    void savePreviousState();
+
+    // The Player's position and camera alpha of the way from where they
+    // were before the latest step to where they are now. The camera turns
+    // along the shortest arc between its two orientations.
+    glm::vec3 interpolatedPosition(float alpha) const;
+    Camera interpolatedCamera(float alpha) const;
 
     // Player overrides all of Entity's movement
     // functions so that it transforms its camera
@@ -0,0 +1,367 @@
+#include "regionfile.h"
+#include "tracer.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char REGION_MAGIC[4] = {'M', 'M', 'R', 'G'};
+static const uint32_t REGION_VERSION = 1;
+// Chunks along each side of a region
+static const int REGION_CHUNKS = 32;
+static const uint32_t SECTOR_BYTES = 4096;
+// The magic number, version and offset table
+static const uint32_t HEADER_BYTES = 8 + 4 * REGION_CHUNKS * REGION_CHUNKS;
+static const uint32_t HEADER_SECTORS = (HEADER_BYTES + SECTOR_BYTES - 1) / SECTOR_BYTES;
+// A table entry's sector count has 8 bits
+static const uint32_t MAX_CHUNK_SECTORS = 255;
+
+static void putU32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t getU32(const uint8_t *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
+static uint32_t entrySector(uint32_t entry) {
+    return entry >> 8;
+}
+
+static uint32_t entryCount(uint32_t entry) {
+    return entry & 0xff;
+}
+
+class MappedFile {
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+#ifdef _WIN32
+    HANDLE m_mapping;
+#endif
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the whole of the file at path. Returns false if it can't.
+    bool map(const std::string &path);
+    const uint8_t* data() const;
+    size_t size() const;
+};
+
+MappedFile::MappedFile()
+    : m_data(nullptr), m_size(0)
+#ifdef _WIN32
+    , m_mapping(nullptr)
+#endif
+{}
+
+MappedFile::~MappedFile() {
+    if (!m_data) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+bool MappedFile::map(const std::string &path) {
+#ifdef _WIN32
+    // Others must be able to keep writing to the file while it is mapped
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    // The mapping keeps the file open on its own
+    CloseHandle(file);
+    if (!m_mapping) {
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        CloseHandle(m_mapping);
+        return false;
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    // A shared mapping sees writes made through the file stream, since
+    // both go through the same page cache
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<size_t>(info.st_size);
+#endif
+    return true;
+}
+
+const uint8_t* MappedFile::data() const {
+    return m_data;
+}
+
+size_t MappedFile::size() const {
+    return m_size;
+}
+
+RegionFile::RegionFile()
+    : m_path(), m_file(), m_mapping(), m_offsets(), m_usedSectors()
+{
+    m_offsets.fill(0);
+}
+
+bool RegionFile::open(const std::string &path) {
+    m_path = path;
+    m_file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!m_file.is_open()) {
+        // fstream only creates files when opened for output alone
+        std::ofstream create(path, std::ios::binary);
+        std::vector<uint8_t> header(HEADER_SECTORS * SECTOR_BYTES, 0);
+        std::copy(REGION_MAGIC, REGION_MAGIC + 4, header.begin());
+        putU32(&header[4], REGION_VERSION);
+        create.write(reinterpret_cast<const char*>(header.data()), header.size());
+        create.close();
+        if (!create) {
+            return false;
+        }
+        m_file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!m_file.is_open()) {
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> header(HEADER_BYTES);
+    m_file.seekg(0, std::ios::end);
+    uint64_t fileBytes = m_file.tellg();
+    m_file.seekg(0);
+    if (!m_file.read(reinterpret_cast<char*>(header.data()), header.size()) ||
+        !std::equal(REGION_MAGIC, REGION_MAGIC + 4, header.begin()) || getU32(&header[4]) != REGION_VERSION) {
+        m_file.close();
+        return false;
+    }
+
+    uint32_t fileSectors = static_cast<uint32_t>((fileBytes + SECTOR_BYTES - 1) / SECTOR_BYTES);
+    m_usedSectors.assign(std::max(fileSectors, HEADER_SECTORS), false);
+    std::fill_n(m_usedSectors.begin(), HEADER_SECTORS, true);
+    for (size_t i = 0; i < m_offsets.size(); i++) {
+        uint32_t entry = getU32(&header[8 + 4 * i]);
+        // Drop entries that a crash left pointing past the end of the file
+        if (entry != 0 && entrySector(entry) >= HEADER_SECTORS &&
+            entrySector(entry) + entryCount(entry) <= fileSectors) {
+            m_offsets[i] = entry;
+            std::fill_n(m_usedSectors.begin() + entrySector(entry), entryCount(entry), true);
+        }
+    }
+    return true;
+}
+
+bool RegionFile::hasChunk(int index) const {
+    return m_offsets[index] != 0;
+}
+
+bool RegionFile::read(int index, std::vector<uint8_t> &out) {
+    uint32_t entry = m_offsets[index];
+    if (entry == 0) {
+        return false;
+    }
+
+    uint8_t length[4];
+    m_file.clear();
+    m_file.seekg(static_cast<uint64_t>(entrySector(entry)) * SECTOR_BYTES);
+    if (!m_file.read(reinterpret_cast<char*>(length), 4)) {
+        return false;
+    }
+    uint32_t bytes = getU32(length);
+    // In 64 bits, so that a corrupt length near 2^32 can't wrap around
+    if (static_cast<uint64_t>(bytes) + 4 > entryCount(entry) * SECTOR_BYTES) {
+        return false;
+    }
+    out.resize(bytes);
+    return static_cast<bool>(m_file.read(reinterpret_cast<char*>(out.data()), bytes));
+}
+
+const uint8_t* RegionFile::map(int index, size_t &bytes, std::shared_ptr<const MappedFile> &mapping) {
+    uint32_t entry = m_offsets[index];
+    if (entry == 0) {
+        return nullptr;
+    }
+
+    uint64_t start = static_cast<uint64_t>(entrySector(entry)) * SECTOR_BYTES;
+    uint64_t end = start + entryCount(entry) * SECTOR_BYTES;
+    if (!m_mapping || m_mapping->size() < end) {
+        // The file has grown since it was last mapped
+        std::shared_ptr<MappedFile> remapped = std::make_shared<MappedFile>();
+        if (!remapped->map(m_path) || remapped->size() < end) {
+            return nullptr;
+        }
+        m_mapping = remapped;
+    }
+
+    const uint8_t *data = m_mapping->data() + start;
+    bytes = getU32(data);
+    if (bytes + 4 > entryCount(entry) * SECTOR_BYTES) {
+        return nullptr;
+    }
+    mapping = m_mapping;
+    return data + 4;
+}
+
+bool RegionFile::write(int index, const std::vector<uint8_t> &data) {
+    uint32_t sectorCount = (data.size() + 4 + SECTOR_BYTES - 1) / SECTOR_BYTES;
+    if (sectorCount > MAX_CHUNK_SECTORS) {
+        return false;
+    }
+
+    // Never overwrite the Chunk's current data, which stays in use until
+    // the table points elsewhere, so a crash mid-write leaves it intact
+    uint32_t oldEntry = m_offsets[index];
+    uint32_t sector = allocateSectors(sectorCount);
+
+    // Pad to whole sectors, so that the file always ends on a sector boundary
+    std::vector<uint8_t> buffer(sectorCount * SECTOR_BYTES, 0);
+    putU32(buffer.data(), data.size());
+    std::copy(data.begin(), data.end(), buffer.begin() + 4);
+    m_file.clear();
+    m_file.seekp(static_cast<uint64_t>(sector) * SECTOR_BYTES);
+    m_file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    m_file.flush();
+    if (!m_file) {
+        freeSectors(sector << 8 | sectorCount);
+        return false;
+    }
+
+    // Only point the table at the data once it is written, and only then
+    // let later writes reuse the old copy's sectors
+    m_offsets[index] = sector << 8 | sectorCount;
+    uint8_t newEntry[4];
+    putU32(newEntry, m_offsets[index]);
+    m_file.seekp(8 + 4 * index);
+    m_file.write(reinterpret_cast<const char*>(newEntry), 4);
+    m_file.flush();
+    if (oldEntry != 0) {
+        freeSectors(oldEntry);
+    }
+    return static_cast<bool>(m_file);
+}
+
+uint32_t RegionFile::allocateSectors(uint32_t sectorCount) {
+    uint32_t run = 0;
+    for (uint32_t s = HEADER_SECTORS; s < m_usedSectors.size(); s++) {
+        run = m_usedSectors[s] ? 0 : run + 1;
+        if (run == sectorCount) {
+            uint32_t start = s + 1 - sectorCount;
+            std::fill_n(m_usedSectors.begin() + start, sectorCount, true);
+            return start;
+        }
+    }
+    // Extend the file, starting with any free sectors already at its end
+    uint32_t start = m_usedSectors.size() - run;
+    m_usedSectors.resize(start + sectorCount, true);
+    std::fill_n(m_usedSectors.begin() + start, sectorCount, true);
+    return start;
+}
+
+void RegionFile::freeSectors(uint32_t entry) {
+    std::fill_n(m_usedSectors.begin() + entrySector(entry), entryCount(entry), false);
+}
+
+RegionStorage::RegionStorage(const std::string &directory, RegionReadMode readMode)
+    : m_directory(directory), m_readMode(readMode), m_regions(), m_mutex()
+{}
+
+bool RegionStorage::open() {
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    return std::filesystem::is_directory(m_directory, error);
+}
+
+RegionFile* RegionStorage::regionFor(int chunkX, int chunkZ, int &index) {
+    int cx = static_cast<int>(std::floor(chunkX / 16.f));
+    int cz = static_cast<int>(std::floor(chunkZ / 16.f));
+    int rx = static_cast<int>(std::floor(cx / static_cast<float>(REGION_CHUNKS)));
+    int rz = static_cast<int>(std::floor(cz / static_cast<float>(REGION_CHUNKS)));
+    index = (cx - REGION_CHUNKS * rx) + REGION_CHUNKS * (cz - REGION_CHUNKS * rz);
+
+    int64_t key = static_cast<int64_t>(static_cast<uint64_t>(static_cast<uint32_t>(rx)) << 32 | static_cast<uint32_t>(rz));
+    auto it = m_regions.find(key);
+    if (it == m_regions.end()) {
+        uPtr<RegionFile> region = mkU<RegionFile>();
+        std::string path = m_directory + "/r." + std::to_string(rx) + "." + std::to_string(rz) + ".region";
+        if (!region->open(path)) {
+            return nullptr;
+        }
+        it = m_regions.emplace(key, move(region)).first;
+    }
+    return it->second.get();
+}
+
+bool RegionStorage::loadChunk(Chunk *chunk) {
+    TRACE_SCOPE("RegionStorage::loadChunk");
+    std::vector<uint8_t> buffer;
+    std::shared_ptr<const MappedFile> mapping;
+    const uint8_t *data = nullptr;
+    size_t bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int index;
+        RegionFile *region = regionFor(chunk->getMinX(), chunk->getMinZ(), index);
+        if (!region) {
+            return false;
+        }
+        if (m_readMode == MAPPED_READS) {
+            data = region->map(index, bytes, mapping);
+        } else if (region->read(index, buffer)) {
+            data = buffer.data();
+            bytes = buffer.size();
+        }
+        if (!data) {
+            return false;
+        }
+    }
+    // Decoding touches only the Chunk and the mapping (which stays valid
+    // while it is held), so it needn't hold up other threads
+    return chunk->deserializeBlocks(data, bytes);
+}
+
+bool RegionStorage::saveChunk(const Chunk &chunk) {
+    TRACE_SCOPE("RegionStorage::saveChunk");
+    std::vector<uint8_t> data = chunk.serializeBlocks();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int index;
+    RegionFile *region = regionFor(chunk.getMinX(), chunk.getMinZ(), index);
+    return region && region->write(index, data);
+}
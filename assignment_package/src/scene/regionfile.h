@@ -0,0 +1,103 @@
+#pragma once
+#include "smartpointerhelp.h"
+#include "chunk.h"
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A read-only memory mapping of a whole file, unmapped when destroyed
+class MappedFile;
+
+// How RegionStorage reads Chunks back from disk
+enum RegionReadMode : unsigned char {
+    // Memory maps each region file and decodes Chunks straight out of the
+    // mapping, so a read costs little more than the page faults
+    MAPPED_READS,
+    // Reads each Chunk's data through the file stream into a buffer first
+    STREAM_READS
+};
+
+// One file on disk holding the saved blocks of a 32 x 32 square of Chunks.
+// The file is divided into 4 KiB sectors. The first two hold a magic
+// number, a version and a table with one 32-bit entry per Chunk: the
+// sector its data starts at in the upper 24 bits and how many sectors it
+// spans in the lower 8, or 0 if the Chunk hasn't been saved. Each Chunk's
+// data starts with its length in bytes, followed by Chunk::serializeBlocks().
+// A rewritten Chunk always moves to the first free run of sectors that fits
+// it, and its old sectors are only freed for later writes once the table
+// points at the new data, so a crash mid-write loses only the new copy.
+// Not thread safe; RegionStorage serializes access.
+class RegionFile {
+private:
+    std::string m_path;
+    std::fstream m_file;
+    // The file as of the last time it was mapped, if it ever has been.
+    // Shared with the readers still decoding from it, so replacing it
+    // when the file grows doesn't pull it out from under them.
+    std::shared_ptr<const MappedFile> m_mapping;
+    std::array<uint32_t, 1024> m_offsets;
+    // Which sectors of the file are in use by the header or some Chunk
+    std::vector<bool> m_usedSectors;
+
+    // Finds (or makes room at the end of the file for) sectorCount free
+    // sectors in a row and marks them as used
+    uint32_t allocateSectors(uint32_t sectorCount);
+    void freeSectors(uint32_t entry);
+
+public:
+    RegionFile();
+
+    // Opens the region file at path, creating an empty one if there is
+    // none. Returns false if it can't be created or isn't a region file.
+    bool open(const std::string &path);
+
+    // index is x + 32 * z, counting Chunks from the region's corner
+    bool hasChunk(int index) const;
+    // Reads a Chunk's saved data into out. Returns false if the Chunk
+    // hasn't been saved or its data can't be read.
+    bool read(int index, std::vector<uint8_t> &out);
+    // Finds a Chunk's saved data in a mapping of the file, remapping it
+    // first if the data lies past the end of the current one. Returns
+    // null if the Chunk hasn't been saved or the file can't be mapped.
+    // The data stays readable for as long as mapping is held, even while
+    // the file is written to.
+    const uint8_t* map(int index, size_t &bytes, std::shared_ptr<const MappedFile> &mapping);
+    // Saves a Chunk's data, replacing anything saved for it before
+    bool write(int index, const std::vector<uint8_t> &data);
+};
+
+// Saves Chunks to and loads them from the region files in one directory,
+// opening each file the first time one of its Chunks is needed. Any thread
+// may call it, since every file access is made under one mutex. With
+// MAPPED_READS, Chunks are decoded from the mapping after the mutex is
+// released, so several threads can load at once.
+class RegionStorage {
+private:
+    std::string m_directory;
+    RegionReadMode m_readMode;
+    // Keyed by region coordinates, as with toKey()
+    std::unordered_map<int64_t, uPtr<RegionFile>> m_regions;
+    std::mutex m_mutex;
+
+    // The region file holding the Chunk with the given corner, and the
+    // Chunk's index within it. Null if the file can't be opened.
+    // m_mutex must be held.
+    RegionFile* regionFor(int chunkX, int chunkZ, int &index);
+
+public:
+    explicit RegionStorage(const std::string &directory, RegionReadMode readMode = MAPPED_READS);
+
+    // Creates the directory if need be. Returns false if it can't be.
+    bool open();
+
+    // Fills in a Chunk's blocks from disk, if it has been saved. Returns
+    // false, leaving the Chunk untouched, if it hasn't.
+    bool loadChunk(Chunk *chunk);
+    // Writes a Chunk's blocks to disk. Returns false on an I/O error.
+    bool saveChunk(const Chunk &chunk);
+};
@@ -1,16 +1,213 @@
 
 #include "terrain.h"
-#include "cube.h"
-#include "mygl.h"
+#include "tracer.h"
 #include <stdexcept>
 #include <iostream>
+#include <deque>
+#include <algorithm>
+
+// Default eviction limits; see setEvictionLimits()
+static const int DEFAULT_EVICTION_RADIUS = 384;
+static const size_t DEFAULT_MEMORY_BUDGET = 512ull << 20;
+// Zones whose nearest block is at most this far from the player may be
+// drawn (the 3 x 3 window) or about to be, so they are never evicted
+static const int MIN_EVICTION_DISTANCE = 128;
 
 Terrain::Terrain(OpenGLContext *context)
-    : m_chunks(), m_generatedTerrain(), m_geomCube(context), mp_context(context)
+    : m_chunks(), m_generatedTerrain(), m_setupChunks(), m_unsavedChunks(), m_lastDrawnFrame(), m_frame(0),
+      m_evictionRadius(DEFAULT_EVICTION_RADIUS), m_memoryBudget(DEFAULT_MEMORY_BUDGET),
+      m_meshesInFlight(), m_chunkGenerations(), m_nextGeneration(0), m_meshMode(GREEDY), m_drawStats(), m_loadStats(), mp_context(context),
+      m_renderer(context), m_generator(), m_completedChunks(), m_completedMutex(), m_storage(), m_workers()
 {}
 
 Terrain::~Terrain() {
-    m_geomCube.destroyVBOdata();
+    saveModifiedChunks(m_unsavedChunks.size());
+    // Every Chunk's mesh lives in the renderer's buffers
+    m_renderer.destroy();
+}
+
+bool Terrain::openWorld(const std::string &directory) {
+    uPtr<RegionStorage> storage = mkU<RegionStorage>(directory);
+    if (!storage->open()) {
+        return false;
+    }
+    m_storage = move(storage);
+    return true;
+}
+
+int Terrain::saveModifiedChunks(unsigned int maxChunks) {
+    if (!m_storage) {
+        return 0;
+    }
+    TRACE_SCOPE("Terrain::saveModifiedChunks");
+    int saved = 0;
+    auto it = m_unsavedChunks.begin();
+    while (it != m_unsavedChunks.end() && saved < static_cast<int>(maxChunks)) {
+        auto chunk = m_chunks.find(*it);
+        if (chunk != m_chunks.end()) {
+            if (!m_storage->saveChunk(*chunk->second)) {
+                // Leave it to be retried on a later call
+                std::cerr << "Could not save the Chunk at " << chunk->second->getMinX() << ", "
+                          << chunk->second->getMinZ() << std::endl;
+                ++it;
+                continue;
+            }
+            chunk->second->markSaved();
+            saved++;
+        }
+        it = m_unsavedChunks.erase(it);
+    }
+    m_loadStats.chunksSaved += saved;
+    return saved;
+}
+
+void Terrain::setEvictionLimits(int radius, size_t memoryBudget) {
+    m_evictionRadius = std::max(radius, MIN_EVICTION_DISTANCE);
+    m_memoryBudget = memoryBudget;
+}
+
+size_t Terrain::getMemoryBytes() const {
+    size_t bytes = 0;
+    for (const auto &entry : m_chunks) {
+        bytes += entry.second->memoryBytes() + entry.second->getMeshStats().totalBytes();
+    }
+    return bytes;
+}
+
+unsigned int Terrain::getChunkCount() const {
+    return m_chunks.size();
+}
+
+int Terrain::evictChunks(glm::vec3 playerPos, unsigned int maxZones) {
+    TRACE_SCOPE("Terrain::evictChunks");
+    struct Zone {
+        int x, z;
+        // Chebyshev distance from the player to the zone's nearest block
+        int distance;
+        uint64_t lastDrawn;
+        size_t bytes;
+        int chunks;
+    };
+    std::unordered_map<int64_t, Zone> zones;
+    size_t totalBytes = 0;
+    int px = static_cast<int>(glm::floor(playerPos.x));
+    int pz = static_cast<int>(glm::floor(playerPos.z));
+    for (const auto &entry : m_chunks) {
+        const Chunk &chunk = *entry.second;
+        int zoneX = 64 * static_cast<int>(glm::floor(chunk.getMinX() / 64.f));
+        int zoneZ = 64 * static_cast<int>(glm::floor(chunk.getMinZ() / 64.f));
+        auto inserted = zones.emplace(toKey(zoneX, zoneZ), Zone{zoneX, zoneZ, 0, 0, 0, 0});
+        Zone &zone = inserted.first->second;
+        if (inserted.second) {
+            int dx = std::max({zoneX - px, px - (zoneX + 63), 0});
+            int dz = std::max({zoneZ - pz, pz - (zoneZ + 63), 0});
+            zone.distance = std::max(dx, dz);
+        }
+        auto drawn = m_lastDrawnFrame.find(entry.first);
+        if (drawn != m_lastDrawnFrame.end()) {
+            zone.lastDrawn = std::max(zone.lastDrawn, drawn->second);
+        }
+        size_t bytes = chunk.memoryBytes() + chunk.getMeshStats().totalBytes();
+        zone.bytes += bytes;
+        zone.chunks++;
+        totalBytes += bytes;
+    }
+
+    // Zones still loading, and those near enough to be drawn, stay put
+    std::vector<Zone> candidates;
+    for (const auto &entry : zones) {
+        if (entry.second.chunks == 16 && entry.second.distance > MIN_EVICTION_DISTANCE) {
+            candidates.push_back(entry.second);
+        }
+    }
+    if (candidates.empty()) {
+        return 0;
+    }
+    int radius = m_evictionRadius;
+    std::sort(candidates.begin(), candidates.end(), [radius](const Zone &a, const Zone &b) {
+        bool aOutside = a.distance > radius;
+        bool bOutside = b.distance > radius;
+        if (aOutside != bOutside) {
+            return aOutside;
+        }
+        if (aOutside) {
+            return a.distance > b.distance;
+        }
+        if (a.lastDrawn != b.lastDrawn) {
+            return a.lastDrawn < b.lastDrawn;
+        }
+        return a.distance > b.distance;
+    });
+
+    int evicted = 0;
+    for (const Zone &zone : candidates) {
+        if (evicted >= static_cast<int>(maxZones) ||
+            (zone.distance <= radius && totalBytes <= m_memoryBudget)) {
+            break;
+        }
+        if (evictZone(zone.x, zone.z)) {
+            totalBytes -= zone.bytes;
+            evicted++;
+        }
+    }
+    return evicted;
+}
+
+bool Terrain::evictZone(int zoneX, int zoneZ) {
+    // Save first, so that a failure leaves the whole zone loaded
+    for (int x = zoneX; x < zoneX + 64; x += 16) {
+        for (int z = zoneZ; z < zoneZ + 64; z += 16) {
+            int64_t key = toKey(x, z);
+            if (m_unsavedChunks.count(key) == 0) {
+                continue;
+            }
+            const uPtr<Chunk> &chunk = m_chunks.at(key);
+            if (!m_storage || !m_storage->saveChunk(*chunk)) {
+                return false;
+            }
+            chunk->markSaved();
+            m_unsavedChunks.erase(key);
+            m_loadStats.chunksSaved++;
+        }
+    }
+
+    for (int x = zoneX; x < zoneX + 64; x += 16) {
+        for (int z = zoneZ; z < zoneZ + 64; z += 16) {
+            int64_t key = toKey(x, z);
+            uPtr<Chunk> &chunk = m_chunks.at(key);
+            ChunkAllocation allocation = chunk->getAllocation();
+            m_renderer.release(allocation);
+            chunk->unlinkNeighbors();
+            // A mesh still being built for it no longer matches any
+            // generation, so uploadBuiltMeshes() drops it when it arrives
+            m_chunks.erase(key);
+            m_setupChunks.erase(key);
+            m_lastDrawnFrame.erase(key);
+            m_meshesInFlight.erase(key);
+            m_chunkGenerations.erase(key);
+        }
+    }
+    // Neighbors outside the zone now have nothing beside them, so their
+    // border faces must be remeshed as visible
+    for (int i = 0; i < 64; i += 16) {
+        markChunkDirty(zoneX - 16, zoneZ + i);
+        markChunkDirty(zoneX + 64, zoneZ + i);
+        markChunkDirty(zoneX + i, zoneZ - 16);
+        markChunkDirty(zoneX + i, zoneZ + 64);
+    }
+    m_generatedTerrain.erase(toKey(zoneX, zoneZ));
+    m_loadStats.chunksEvicted += 16;
+    return true;
+}
+
+void Terrain::loadOrGenerate(Chunk *chunk) {
+    if (!m_storage || !m_storage->loadChunk(chunk)) {
+        m_generator.generateChunkBlocks(chunk, chunk->getMinX(), chunk->getMinZ());
+    }
+}
+
+void Terrain::initializeGL() {
+    m_renderer.create();
 }
 
 // Combine two 32-bit ints into one 64-bit int
@@ -114,6 +311,17 @@ void Terrain::setBlockAt(int x, int y, int z, BlockType t)
                       static_cast<unsigned int>(y),
                       static_cast<unsigned int>(z - chunkOrigin.y),
                       t);
+
+        // Neighbors sample this Chunk's border blocks when meshing,
+        // so edits along an edge dirty them as well
+        int cx = static_cast<int>(chunkOrigin.x);
+        int cz = static_cast<int>(chunkOrigin.y);
+        m_unsavedChunks.insert(toKey(cx, cz));
+        markChunkDirty(cx, cz);
+        if (x - cx == 0) markChunkDirty(cx - 16, cz);
+        if (x - cx == 15) markChunkDirty(cx + 16, cz);
+        if (z - cz == 0) markChunkDirty(cx, cz - 16);
+        if (z - cz == 15) markChunkDirty(cx, cz + 16);
     }
     else {
         throw std::out_of_range("Coordinates " + std::to_string(x) +
@@ -122,8 +330,28 @@ void Terrain::setBlockAt(int x, int y, int z, BlockType t)
     }
 }
 
+void Terrain::markChunkDirty(int x, int z) {
+    auto it = m_setupChunks.find(toKey(x, z));
+    if (it != m_setupChunks.end()) {
+        it->second = false;
+    }
+}
+
+bool Terrain::hasChunksAround(glm::vec3 p, int radius) const {
+    int x = static_cast<int>(glm::floor(p.x));
+    int z = static_cast<int>(glm::floor(p.z));
+    return hasChunkAt(x, z) &&
+           hasChunkAt(x + radius, z + radius) && hasChunkAt(x + radius, z - radius) &&
+           hasChunkAt(x - radius, z + radius) && hasChunkAt(x - radius, z - radius);
+}
+
 Chunk* Terrain::instantiateChunkAt(int x, int z) {
-    uPtr<Chunk> chunk = mkU<Chunk>(mp_context, x, z);
+    return insertChunk(mkU<Chunk>(x, z));
+}
+
+Chunk* Terrain::insertChunk(uPtr<Chunk> chunk) {
+    int x = chunk->getMinX();
+    int z = chunk->getMinZ();
     Chunk *cPtr = chunk.get();
     m_chunks[toKey(x, z)] = move(chunk);
     // Set the neighbor pointers of itself and its neighbors
@@ -144,15 +372,14 @@ Chunk* Terrain::instantiateChunkAt(int x, int z) {
         cPtr->linkNeighbor(chunkWest, XNEG);
     }
 
-    m_setupChunks.insert({toKey(x, z), false});
+    m_setupChunks[toKey(x, z)] = false;
+    m_chunkGenerations[toKey(x, z)] = m_nextGeneration++;
 
     return cPtr;
-    return cPtr;
 }
 
-void Terrain::checkForNewChunks() {
-    // Get player position
-    glm::vec2 chunkPos = getChunkPos();
+void Terrain::checkForNewChunks(glm::vec3 playerPos) {
+    glm::vec2 chunkPos = getChunkPos(playerPos);
 
     int chunkX = static_cast<int>(chunkPos.x);
     int chunkZ = static_cast<int>(chunkPos.y);
@@ -172,26 +399,98 @@ void Terrain::checkForNewChunks() {
 
 void Terrain::checkAndLoadChunk(int x, int z) {
     if (!hasChunkAt(x, z)) {
-        //do everyting to initialize the chunk
-        instantiateChunkAt(x, z);
-
-        const uPtr<Chunk> &newChunk = getChunkAt(x, z);
-        newChunk->createVBOdata();
-        m_setupChunks[toKey(x, z)] = true;
-    } else if (m_setupChunks.count(toKey(x, z)) == 0) {
-        const uPtr<Chunk> &newChunk = getChunkAt(x, z);
-        newChunk->createVBOdata();
-        m_setupChunks.insert({toKey(x, z), true});
-    } else if (!m_setupChunks.at(toKey(x, z))) {
-        const uPtr<Chunk> &newChunk = getChunkAt(x, z);
-        newChunk->createVBOdata();
-        m_setupChunks[toKey(x, z)] = true;
-    }
-}
-
-glm::vec2 Terrain::getChunkPos() {
-    // Get player position
-    glm::vec3 playerPos = static_cast<MyGL*>(mp_context)->m_player.mcr_position;
+        // The Chunk will be loaded from disk or generated by the worker
+        // threads. If its zone is already queued there is nothing to do
+        // but wait for it.
+        if (!hasTerrainZoneAt(x, z)) {
+            requestTerrainZone(x, z);
+        }
+    } else {
+        requestMesh(x, z);
+    }
+}
+
+void Terrain::requestMesh(int x, int z) {
+    int64_t key = toKey(x, z);
+    auto setup = m_setupChunks.find(key);
+    if (setup == m_setupChunks.end() || setup->second || m_meshesInFlight.count(key) > 0) {
+        return;
+    }
+
+    // Optimistically mark the Chunk as set up. If it is edited before
+    // the mesh comes back, setBlockAt flips this to false again and the
+    // Chunk is requeued once the stale mesh has been uploaded.
+    setup->second = true;
+    m_meshesInFlight.insert(key);
+
+    // std::function needs a copyable callable, hence the shared pointer
+    sPtr<ChunkSnapshot> snap(getChunkAt(x, z)->snapshot());
+    MeshMode mode = m_meshMode;
+    uint64_t generation = m_chunkGenerations.at(key);
+    m_workers.enqueue([this, key, generation, snap, mode]() {
+        uPtr<ChunkMesh> mesh = mkU<ChunkMesh>(Chunk::buildMesh(*snap, mode));
+
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        m_completedMeshes.push_back({key, generation, move(mesh)});
+    });
+}
+
+void Terrain::setMeshMode(MeshMode mode) {
+    if (mode == m_meshMode) {
+        return;
+    }
+    m_meshMode = mode;
+    for (auto &entry : m_setupChunks) {
+        entry.second = false;
+    }
+}
+
+MeshMode Terrain::getMeshMode() const {
+    return m_meshMode;
+}
+
+MeshStats Terrain::getMeshStats() const {
+    MeshStats total;
+    for (const auto &entry : m_chunks) {
+        total += entry.second->getMeshStats();
+    }
+    return total;
+}
+
+int Terrain::uploadBuiltMeshes(unsigned int maxMeshes) {
+    TRACE_SCOPE("Terrain::uploadBuiltMeshes");
+    std::vector<BuiltMesh> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        unsigned int n = std::min(maxMeshes, static_cast<unsigned int>(m_completedMeshes.size()));
+        for (unsigned int i = 0; i < n; i++) {
+            ready.push_back(move(m_completedMeshes[i]));
+        }
+        m_completedMeshes.erase(m_completedMeshes.begin(), m_completedMeshes.begin() + n);
+    }
+
+    int uploaded = 0;
+    for (BuiltMesh &built : ready) {
+        // Built for a Chunk that has since been evicted. If it was loaded
+        // again, the new Chunk's own build is the one in flight.
+        auto generation = m_chunkGenerations.find(built.key);
+        if (generation == m_chunkGenerations.end() || generation->second != built.generation) {
+            continue;
+        }
+        m_meshesInFlight.erase(built.key);
+        Chunk &chunk = *m_chunks.at(built.key);
+        chunk.setMesh(*built.mesh, m_renderer.upload(*built.mesh, chunk.getAllocation()));
+        uploaded++;
+    }
+    if (uploaded > 0) {
+        m_renderer.defragment();
+    }
+    m_loadStats.meshesUploaded += uploaded;
+
+    return uploaded;
+}
+
+glm::vec2 Terrain::getChunkPos(glm::vec3 playerPos) {
     // Check whether the player is within 16 blocks of the edge of a Chunk which does not have another neighboring Chunk loaded,
     // and if so, insert a new Chunk into the Terrain, and set up the VBOs.
 
@@ -200,9 +499,7 @@ glm::vec2 Terrain::getChunkPos() {
     return chunkPos;
 }
 
-glm::vec2 Terrain::getTerrainPos() {
-    // Get player position
-    glm::vec3 playerPos = static_cast<MyGL*>(mp_context)->m_player.mcr_position;
+glm::vec2 Terrain::getTerrainPos(glm::vec3 playerPos) {
     // Check whether the player is within 16 blocks of the edge of a Chunk which does not have another neighboring Chunk loaded,
     // and if so, insert a new Chunk into the Terrain, and set up the VBOs.
 
@@ -211,48 +508,210 @@ glm::vec2 Terrain::getTerrainPos() {
     return chunkPos;
 }
 
-// TODO: When you make Chunk inherit from Drawable, change this code so
-// it draws each Chunk with the given ShaderProgram, remembering to set the
-// model matrix to the proper X and Z translation!
-void Terrain::draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram) {
-    for(int z = minZ; z < maxZ; z += 16) {
-        for(int x = minX; x < maxX; x += 16) {
-            if (hasChunkAt(x, z)) {
-                const uPtr<Chunk> &chunk = getChunkAt(x, z);
-                if (m_setupChunks.count(toKey(x, z)) > 0 && !m_setupChunks.at(toKey(x, z))) {
+// The step between neighboring sections in each Direction
+static const std::array<glm::ivec3, 6> directionOffsets = {
+    glm::ivec3(1, 0, 0), glm::ivec3(-1, 0, 0),
+    glm::ivec3(0, 1, 0), glm::ivec3(0, -1, 0),
+    glm::ivec3(0, 0, 1), glm::ivec3(0, 0, -1)
+};
 
-                    chunk->createVBOdata();
-                    m_setupChunks[toKey(x, z)] = true;
+// Directions come in +/- pairs, so flipping the lowest bit reverses one
+static Direction opposite(Direction d) {
+    return static_cast<Direction>(d ^ 1);
+}
+
+std::unordered_map<int64_t, uint16_t> Terrain::findVisibleSections(int minX, int maxX, int minZ, int maxZ,
+                                                                    const Frustum &frustum, const glm::vec3 &eye) const {
+    TRACE_SCOPE("Terrain::findVisibleSections");
+    std::unordered_map<int64_t, uint16_t> visible;
+    const int sizeX = (maxX - minX) / 16;
+    const int sizeZ = (maxZ - minZ) / 16;
+
+    auto inBounds = [&](glm::ivec3 s) {
+        return s.x >= 0 && s.x < sizeX && s.y >= 0 && s.y < 16 && s.z >= 0 && s.z < sizeZ;
+    };
+    auto inFrustum = [&](glm::ivec3 s) {
+        glm::vec3 corner(minX + 16 * s.x, 16 * s.y, minZ + 16 * s.z);
+        return frustum.intersectsAABB(corner, corner + glm::vec3(16.f));
+    };
+    auto markVisible = [&](glm::ivec3 s) {
+        visible[toKey(minX + 16 * s.x, minZ + 16 * s.z)] |= 1 << s.y;
+    };
+
+    glm::ivec3 start(glm::floor((eye - glm::vec3(minX, 0, minZ)) / 16.f));
+    if (!inBounds(start)) {
+        // The camera is above or below the world, so there is no
+        // section to start from. Fall back to frustum culling alone.
+        for (int z = 0; z < sizeZ; z++) {
+            for (int y = 0; y < 16; y++) {
+                for (int x = 0; x < sizeX; x++) {
+                    if (inFrustum(glm::ivec3(x, y, z))) {
+                        markVisible(glm::ivec3(x, y, z));
+                    }
                 }
+            }
+        }
+        return visible;
+    }
+
+    // A section still to be visited, the face it was entered through,
+    // and every Direction taken on the way there from the camera
+    struct Step {
+        glm::ivec3 section;
+        Direction entry;
+        uint8_t directions;
+    };
+    std::vector<bool> queued(sizeX * 16 * sizeZ, false);
+    std::deque<Step> queue;
+    queue.push_back({start, XPOS, 0});
+    queued[start.x + sizeX * (start.y + 16 * start.z)] = true;
+
+    while (!queue.empty()) {
+        Step step = queue.front();
+        queue.pop_front();
+        markVisible(step.section);
+
+        int chunkX = minX + 16 * step.section.x;
+        int chunkZ = minZ + 16 * step.section.z;
+        // Chunks that are missing or not meshed yet hide nothing
+        SectionVisibility vis = SectionVisibility::open();
+        if (hasChunkAt(chunkX, chunkZ)) {
+            vis = getChunkAt(chunkX, chunkZ)->getSectionVisibility(step.section.y);
+        }
+
+        for (int d = 0; d < 6; d++) {
+            Direction dir = static_cast<Direction>(d);
+            // Only ever move away from the camera, which keeps the fill from
+            // wrapping around solid terrain into sections behind it
+            if (step.directions & (1 << opposite(dir))) {
+                continue;
+            }
+            // The camera's own section can be left through any face
+            if (step.directions != 0 && !vis.connects(step.entry, dir)) {
+                continue;
+            }
+
+            glm::ivec3 next = step.section + directionOffsets[d];
+            if (!inBounds(next)) {
+                continue;
+            }
+            int nextIdx = next.x + sizeX * (next.y + 16 * next.z);
+            if (queued[nextIdx]) {
+                continue;
+            }
+            queued[nextIdx] = true;
+            if (inFrustum(next)) {
+                queue.push_back({next, opposite(dir), static_cast<uint8_t>(step.directions | (1 << d))});
+            }
+        }
+    }
+    return visible;
+}
 
-                shaderProgram->setModelMatrix(glm::translate(mat4(1.f), vec3(x, 0.f, z)));
-                shaderProgram->drawInterleaved(static_cast<Drawable&>(*chunk));
+void Terrain::queueSections(Chunk &chunk, uint16_t sections, bool transparent) {
+    const std::array<int, 17> &offsets = chunk.getSectionOffsets(transparent);
+    glm::vec3 origin(chunk.getMinX(), 0.f, chunk.getMinZ());
+
+    // Sections are stored bottom to top, so each run of consecutive
+    // visible sections can go out as a single draw
+    int s = 0;
+    while (s < 16) {
+        if (!((sections >> s) & 1)) {
+            s++;
+            continue;
+        }
+        int end = s;
+        while (end < 16 && ((sections >> end) & 1)) {
+            end++;
+        }
+
+        m_renderer.queue(chunk.getAllocation(), origin, transparent, offsets[s], offsets[end] - offsets[s]);
+        s = end;
+    }
+}
+
+void Terrain::draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram,
+                   const Frustum &frustum, const glm::vec3 &eye, GpuProfiler *profiler) {
+    TRACE_SCOPE("Terrain::draw");
+    m_frame++;
+    for(int z = minZ; z < maxZ; z += 16) {
+        for(int x = minX; x < maxX; x += 16) {
+            if (hasChunkAt(x, z)) {
+                requestMesh(x, z);
             }
         }
     }
 
-    // Transparent
+    std::unordered_map<int64_t, uint16_t> visibleSections = findVisibleSections(minX, maxX, minZ, maxZ, frustum, eye);
+
+    std::vector<std::pair<Chunk*, uint16_t>> visible;
     for(int z = minZ; z < maxZ; z += 16) {
         for(int x = minX; x < maxX; x += 16) {
             if (hasChunkAt(x, z)) {
                 const uPtr<Chunk> &chunk = getChunkAt(x, z);
-                if (m_setupChunks.count(toKey(x, z)) > 0 && !m_setupChunks.at(toKey(x, z))) {
 
-                    chunk->createVBOdata();
-                    m_setupChunks[toKey(x, z)] = true;
+                // Chunks whose first mesh hasn't arrived yet, or that are
+                // all air, have nothing to draw
+                if (!chunk->hasMesh() || !chunk->hasGeometry()) {
+                    continue;
+                }
+
+                if (!frustum.intersectsAABB(chunk->getBoundsMin(), chunk->getBoundsMax())) {
+                    m_drawStats.chunksCulled++;
+                    continue;
+                }
+
+                auto sections = visibleSections.find(toKey(x, z));
+                if (sections == visibleSections.end() || sections->second == 0) {
+                    m_drawStats.chunksOccluded++;
+                    continue;
                 }
 
-                shaderProgram->setModelMatrix(glm::translate(mat4(1.f), vec3(x, 0.f, z)));
-                shaderProgram->drawTpInterleaved(static_cast<Drawable&>(*chunk));
+                m_drawStats.chunksDrawn++;
+                const std::array<int, 17> &offsets = chunk->getSectionOffsets(false);
+                const std::array<int, 17> &tpOffsets = chunk->getSectionOffsets(true);
+                for (int s = 0; s < 16; s++) {
+                    if (((sections->second >> s) & 1) &&
+                        (offsets[s + 1] > offsets[s] || tpOffsets[s + 1] > tpOffsets[s])) {
+                        m_drawStats.sectionsDrawn++;
+                    }
+                }
+                visible.push_back({chunk.get(), sections->second});
+                m_lastDrawnFrame[toKey(x, z)] = m_frame;
             }
         }
     }
+
+    // The renderer draws every opaque section before any transparent one
+    for (auto &entry : visible) {
+        queueSections(*entry.first, entry.second, false);
+        queueSections(*entry.first, entry.second, true);
+    }
+    m_drawStats.drawCalls += m_renderer.draw(*shaderProgram, profiler);
+}
+
+void Terrain::resetDrawStats() {
+    m_drawStats = DrawStats();
+}
+
+const DrawStats& Terrain::getDrawStats() const {
+    return m_drawStats;
+}
+
+const LoadStats& Terrain::getLoadStats() const {
+    return m_loadStats;
+}
+
+ArenaStats Terrain::getVertexArenaStats() const {
+    return m_renderer.vertexStats();
+}
+
+ArenaStats Terrain::getIndexArenaStats() const {
+    return m_renderer.indexStats();
 }
 
 void Terrain::CreateTestScene()
 {
-    m_geomCube.createVBOdata();
-
     // Create the Chunks that will
     // store the blocks for our
     // initial world space
@@ -294,9 +753,7 @@ void Terrain::CreateTestScene()
 // generation zone, ie:
 void Terrain::CreateProceduralTerrain(int minX,int maxX, int minZ, int maxZ)
 {
-    // TODO: DELETE THIS LINE WHEN YOU DELETE m_geomCube!
-    m_geomCube.createVBOdata();
-
+    TRACE_SCOPE("Terrain::CreateProceduralTerrain");
     // Create the Chunks that will
     // store the blocks for our
     // initial world space
@@ -314,294 +771,72 @@ void Terrain::CreateProceduralTerrain(int minX,int maxX, int minZ, int maxZ)
         }
     }
 
-    // Create the basic terrain floor
-    for(int x = minX; x < maxX; x ++) {
-        for(int z = minZ; z < maxZ; z ++) {
-            float b1 = glm::smoothstep(0.25f, 0.75f, PerlinNoise(vec2(x,z)/1.f));
-            float b2 = glm::smoothstep(0.25f, 0.75f, PerlinNoise(vec2(x,z)/1024.f + 1323112334432432.f));
-            int Y = calcHeight(x,z,b1,b2);
-            for(int y = 0;y<=std::max(Y,138);y++){
-//                if (y<std::max(Y,138))
-//                    continue;
-                setBlockAt(x, y, z, biomeBlock(x,y,z,Y,b1,b2));
+    for(int x = minX; x < maxX; x += 16) {
+        for(int z = minZ; z < maxZ; z += 16) {
+            Chunk *chunk = getChunkAt(x, z).get();
+            loadOrGenerate(chunk);
+            if (chunk->isModified() && m_storage) {
+                m_unsavedChunks.insert(toKey(x, z));
             }
         }
     }
 }
 
-vec2 Terrain::smoothF(vec2 uv)
-{
-    return uv*uv*(3.f-2.f*uv);
-}
-
-float Terrain::noise(vec2 uv)
-{
-    const float k = 257.;
-    vec4 l  = vec4(floor(uv),fract(uv));
-    float u = l.x + l.y * k;
-    vec4 v  = vec4(u, u+1.,u+k, u+k+1.);
-    v       = fract(fract(1.23456789f *v)*v/.987654321f);
-    vec2 L    = smoothF(vec2(l[2],l[3]));
-    l.x     = mix(v.x, v.y, L[0]);
-    l.y     = mix(v.z, v.w, L[0]);
-    return    mix(l.x, l.y, L[1]);
-}
-
-float Terrain::fbm(vec2 uv)
-{
-    float a = 0.5;
-    float f = 5.0;
-    float n = 0.;
-    int it = 8;
-    for(int i = 0; i < 32; i++)
-    {
-        if(i<it)
-        {
-            n += noise(uv*f)*a;
-            a *= .5;
-            f *= 2.;
+void Terrain::requestTerrainZone(int x, int z) {
+    int zoneX = 64 * static_cast<int>(glm::floor(x / 64.f));
+    int zoneZ = 64 * static_cast<int>(glm::floor(z / 64.f));
+    // Mark the zone as generated right away so it is only ever queued once
+    m_generatedTerrain.insert(toKey(zoneX, zoneZ));
+
+    for(int cx = zoneX; cx < zoneX + 64; cx += 16) {
+        for(int cz = zoneZ; cz < zoneZ + 64; cz += 16) {
+            m_workers.enqueue([this, cx, cz]() {
+                // The Chunk is private to this job until it is pushed
+                // onto the completion queue, so no locking is needed here
+                uPtr<Chunk> chunk = mkU<Chunk>(cx, cz);
+                loadOrGenerate(chunk.get());
+
+                std::lock_guard<std::mutex> lock(m_completedMutex);
+                m_completedChunks.push_back(move(chunk));
+            });
         }
     }
-    return n;
 }
 
-float Terrain::WorleyNoise(vec2 uv)
-{
-    // Tile the space
-    //    uv = uv + fbm2(uv / 4) * 5.f;
-    vec2 uvInt = floor(uv);
-    vec2 uvFract = fract(uv);
-
-    float minDist = 1.0; // Minimum distance initialized to max.
-    float secondMinDist = 1.0;
-    vec2 closestPoint;
-
-    // Search all neighboring cells and this cell for their point
-    for(int y = -1; y <= 1; y++)
+int Terrain::insertGeneratedChunks(unsigned int maxChunks) {
+    TRACE_SCOPE("Terrain::insertGeneratedChunks");
+    std::vector<uPtr<Chunk>> ready;
     {
-        for(int x = -1; x <= 1; x++)
-        {
-            vec2 neighbor = vec2(float(x), float(y));
-
-            // Random point inside current neighboring cell
-            vec2 point = random2(uvInt + neighbor);
-
-            // Compute the distance b/t the point and the fragment
-            // Store the min dist thus far
-            vec2 diff = neighbor + point - uvFract;
-            float dist = length(diff);
-            if(dist < minDist) {
-                secondMinDist = minDist;
-                minDist = dist;
-                closestPoint = point;
-            }
-            else if(dist < secondMinDist) {
-                secondMinDist = dist;
-            }
+        std::lock_guard<std::mutex> lock(m_completedMutex);
+        unsigned int n = std::min(maxChunks, static_cast<unsigned int>(m_completedChunks.size()));
+        for (unsigned int i = 0; i < n; i++) {
+            ready.push_back(move(m_completedChunks[i]));
         }
+        m_completedChunks.erase(m_completedChunks.begin(), m_completedChunks.begin() + n);
     }
-    float height;// = 0.5 * minDist + 0.5 * secondMinDist;
-    height = minDist;
-    //    height = height * height;
-    return height;
-}
-
-int Terrain::calcHeight(int x, int z, float b1, float b2){
-    vec2 xz = vec2(x,z);
 
-    float h = 0;
-
-    float amp = 1/2.0;
-    float freq1 = 256;
-    float freq2 = 64;
-
-    for(int i = 0; i < 4; ++i) {
-        vec2 offset = vec2((float)fbm(xz / 256.f), (float)fbm(xz / 300.f))+ vec2(1000);
-
-        float h1 = PerlinNoise((xz + offset * 75.f) / freq1);
-
-        h += h1 * amp;
-
-        amp *= 0.5;
-        freq1 *= 0.5;
-    }
-
-    float H = 0;
-    amp = 1/2.0;
-    for(int i = 0; i < 4; ++i) {
-        float h2 = WorleyNoise(xz / freq2);
-
-        H += h2 * amp;
-
-        amp *= 0.5;
-        freq2 *= 0.5;
-    }
-
-    float v = mix(h,H,b1);
-
-
-    h = 0;
-    amp = 1/2.0;
-    freq1 = 512;
-    freq2 = 128;
-
-    for(int i = 0; i < 4; ++i) {
-        vec2 offset = vec2((float)fbm(xz / 2560.f), (float)fbm(xz / 3000.f));
-
-        float h1 = PerlinNoise((xz + offset * 175.f) / freq1);
-
-        h += h1 * amp;
-
-        amp *= 0.5;
-        freq1 *= 0.5;
-    }
-
-    H = 0;
-    amp = 1/2.0;
-    for(int i = 0; i < 4; ++i) {
-        float h2 = WorleyNoise(xz / freq2)*0.2;
-
-        H += h2 * amp;
-
-        amp *= 0.5;
-        freq2 *= 0.5;
-    }
-
-    v = floor(128+mix(v,mix(h,H,b1), b2)*128);
-    return v;
-}
-
-float Terrain::surflet(vec2 P, vec2 gridPoint)
-{
-    // Compute falloff function by converting linear distance to a polynomial (quintic smootherstep function)
-    float distX = abs(P.x - gridPoint.x);
-    float distY = abs(P.y - gridPoint.y);
-    float tX = 1 - 6 * std::pow(distX, 5.0) + 15 * std::pow(distX, 4.0) - 10 * std::pow(distX, 3.0);
-    float tY = 1 - 6 * std::pow(distY, 5.0) + 15 * std::pow(distY, 4.0) - 10 * std::pow(distY, 3.0);
-
-    // Get the random vector for the grid point
-    vec2 gradient = random2(gridPoint);
-    // Get the vector from the grid point to P
-    vec2 diff = P - gridPoint;
-    // Get the value of our height field by dotting grid->P with our gradient
-    float height = dot(diff, gradient);
-    // Scale our height field (i.e. reduce it) by our polynomial falloff function
-    return height * tX * tY;
-}
-
-vec2 Terrain::random2( vec2 p ) {
-    return normalize(2.f * (glm::fract(sin(vec2(dot(p,vec2(127.1,311.7)),dot(p,vec2(269.5,183.3))))
-                                       * 43758.5453f)) - 1.f);
-}
-
-float Terrain::PerlinNoise(vec2 uv)
-{
-    // Tile the space
-    vec2 uvXLYL = floor(uv);
-    vec2 uvXHYL = uvXLYL + vec2(1,0);
-    vec2 uvXHYH = uvXLYL + vec2(1,1);
-    vec2 uvXLYH = uvXLYL + vec2(0,1);
-
-    return surflet(uv, uvXLYL) + surflet(uv, uvXHYL) + surflet(uv, uvXHYH) + surflet(uv, uvXLYH);
-}
-
-vec3 Terrain::random3( vec3 p ) {
-    return fract(sin(vec3(dot(p,vec3(127.1, 311.7, 321.5)),
-                          dot(p,vec3(269.5, 183.3,43243.0)),
-                          dot(p, vec3(420.6, 631.2,321.43))
-                          )) * 43758.5453f);
-}
-
-
-vec3 Terrain::pow(vec3 v, float f)
-{
-    return vec3(std::pow(v[0],f),std::pow(v[1],f),std::pow(v[2],f));
-}
-
-float Terrain::surflet(vec3 p, vec3 gridPoint) {
-    // Compute the distance between p and the grid point along each axis, and warp it with a
-    // quintic function so we can smooth our cells
-    vec3 t2 = abs(p - gridPoint);
-    vec3 t = vec3(1.f) - 6.f * pow(t2, 5.f) + 15.f * pow(t2, 4.f) - 10.f * pow(t2, 3.f);//+20.f*pow(t2,2.f);
-    // Get the random vector for the grid point (assume we wrote a function random2
-    // that returns a vec2 in the range [0, 1])
-    vec3 gradient = random3(gridPoint) * 2.f - vec3(1., 1., 1.);
-    // Get the vector from the grid point to P
-    vec3 diff = p - gridPoint;
-    // Get the value of our height field by dotting grid->P with our gradient
-    float height = dot(diff, gradient);
-    // Scale our height field (i.e. reduce it) by our polynomial falloff function
-    //    std::cout<<height<<t[0]<<t[1]<<t[2]<<std::endl;
-    return height * t.x * t.y * t.z;
-}
-
-
-float Terrain::perlinNoise3D(vec3 p) {
-    float surfletSum = 0.f;
-    // Iterate over the four integer corners surrounding uv
-    for(int dx = 0; dx <= 1; ++dx) {
-        for(int dy = 0; dy <= 1; ++dy) {
-            for(int dz = 0; dz <= 1; ++dz) {
-                float s = surflet(p, floor(p) + vec3(dx, dy, dz));
-                //                std::cout<<s<<std::endl;
-                surfletSum += s;
+    for (uPtr<Chunk> &chunk : ready) {
+        int x = chunk->getMinX();
+        int z = chunk->getMinZ();
+        // A freshly generated Chunk isn't on disk yet. With nowhere to save
+        // it, it can be generated again instead.
+        if (chunk->isModified()) {
+            if (m_storage) {
+                m_unsavedChunks.insert(toKey(x, z));
             }
+        } else {
+            m_loadStats.chunksFromDisk++;
         }
+        insertChunk(move(chunk));
+
+        // Neighbors that were already set up drew their shared border as if
+        // nothing was next to them, so their VBOs need to be rebuilt.
+        markChunkDirty(x + 16, z);
+        markChunkDirty(x - 16, z);
+        markChunkDirty(x, z + 16);
+        markChunkDirty(x, z - 16);
     }
-    return surfletSum;
-}
+    m_loadStats.chunksInserted += ready.size();
 
-
-BlockType Terrain::biomeBlock(int x, int y, int z, int maxY, float b1, float b2){
-    if(y==0)
-        return BEDROCK;
-    if(b2<0.5){
-        if (y<=128 && y<=maxY)
-        {
-            vec3 v = vec3(x,y,z);
-            float freq1 = 64;
-            float freq2 = 16;
-            vec2 xz = vec2(x,z);
-            vec3 offset = vec3((float)fbm(xz / 256.f),0, (float)fbm(xz / 300.f))+ vec3(1000);
-            float p1 =perlinNoise3D((v+offset)/freq1);
-            float p2 =perlinNoise3D((v+offset)/freq2);
-            return p1<= -0.35 || abs(p2)<0.125? y<=25?LAVA: maxY<128?WATER: EMPTY  :STONE;
-        }
-        if(y>maxY)
-            return WATER;
-        if(b1<0.5){
-            if(y==maxY)
-                return GRASS;
-            return DIRT;
-        }
-        else{
-            if (y>=200 && y==maxY)
-                return SNOW;
-            float h = WorleyNoise(vec2(x,z)/64.f);
-            return h<0.95?STONE:DIRT;
-        }
-    }
-    else{
-        if (y<=128 && y<=maxY)
-        {
-            vec3 v = vec3(x,y,z);
-            float freq1 = 64;
-            float freq2 = 16;
-            vec2 xz = vec2(x,z);
-            vec3 offset = vec3((float)fbm(xz / 256.f),0, (float)fbm(xz / 300.f))+ vec3(1000);
-            float p1 =perlinNoise3D((v+offset)/freq1);
-            float p2 =perlinNoise3D((v+offset)/freq2);
-            return p1<= -0.35 || abs(p2)<0.125? y<=25?LAVA: EMPTY  :STONE;
-        }
-        if(b1<0.5){
-            if(y>maxY)
-                return EMPTY;
-            return y<maxY-3?STONE:SAND;
-        }
-        else{
-            if(y>maxY)
-                return ICE;
-            return y<maxY-5?STONE:SNOW;
-        }
-    }
+    return static_cast<int>(ready.size());
 }
@@ -5,8 +5,15 @@
 #include <array>
 #include <unordered_map>
 #include <unordered_set>
+#include <cstdint>
+#include <mutex>
+#include <vector>
 #include "shaderprogram.h"
-#include "cube.h"
+#include "workerpool.h"
+#include "frustum.h"
+#include "chunkrenderer.h"
+#include "terraingenerator.h"
+#include "regionfile.h"
 
 
 using namespace std;
@@ -16,6 +23,31 @@ using namespace glm;
 int64_t toKey(int x, int z);
 glm::ivec2 toCoords(int64_t k);
 
+// How many Chunks the last frame's draw() calls submitted, and how many
+// they skipped for lying outside the view frustum or behind solid terrain
+struct DrawStats {
+    unsigned int chunksDrawn = 0;
+    unsigned int chunksCulled = 0;
+    unsigned int chunksOccluded = 0;
+    // Sections with geometry that were reachable from the camera
+    unsigned int sectionsDrawn = 0;
+    // GL draw calls those sections were submitted in
+    unsigned int drawCalls = 0;
+};
+
+// How many generated Chunks and built meshes Terrain has taken in from the
+// worker threads since it was created, and how many Chunks it has
+// loaded from and saved to disk
+struct LoadStats {
+    unsigned int chunksInserted = 0;
+    unsigned int meshesUploaded = 0;
+    // Of chunksInserted, the ones read from disk rather than generated
+    unsigned int chunksFromDisk = 0;
+    unsigned int chunksSaved = 0;
+    // Chunks unloaded by evictChunks()
+    unsigned int chunksEvicted = 0;
+};
+
 // The container class for all of the Chunks in the game.
 // Ultimately, while Terrain will always store all Chunks,
 // not all Chunks will be drawn at any given time as the world
@@ -39,28 +71,133 @@ private:
     // one 64 x 64 area with its lower-left corner at (0, 0).
     // When milestone 1 has been implemented, the Player can move around the
     // world to add more "terrain generation zone" IDs to this set.
-    // While only the 3 x 3 collection of terrain generation zones
-    // surrounding the Player should be rendered, the Chunks
-    // in the Terrain will never be deleted until the program is terminated.
+    // Only the 3 x 3 collection of terrain generation zones
+    // surrounding the Player is rendered, and evictChunks() unloads
+    // whole zones again once they are far away or memory runs short.
+    // A zone is added to this set as soon as its generation is requested,
+    // so its Chunks may still be in flight on the worker threads.
     std::unordered_set<int64_t> m_generatedTerrain;
 
+    // Whether each Chunk's uploaded mesh reflects its current blocks.
+    // A false entry means the Chunk needs to be (re)meshed.
     std::unordered_map<int64_t, bool> m_setupChunks;
+    // Chunks whose blocks differ from what is saved on disk. Without a
+    // world open, only the Chunks the player has edited, which
+    // evictChunks() must keep since they can't be regenerated.
+    std::unordered_set<int64_t> m_unsavedChunks;
+    // The last frame (counted by draw()) in which each Chunk was drawn
+    std::unordered_map<int64_t, uint64_t> m_lastDrawnFrame;
+    uint64_t m_frame;
+    // Zones further than this many blocks from the player are unloaded
+    int m_evictionRadius;
+    // Past this many bytes of Chunk and mesh memory, the least recently
+    // drawn zones are unloaded as well, however near
+    size_t m_memoryBudget;
+    // Chunks that currently have a mesh being built on a worker thread.
+    // At most one build per Chunk is ever in flight.
+    std::unordered_set<int64_t> m_meshesInFlight;
+    // Which insertion of its key each Chunk in m_chunks was, counted by
+    // m_nextGeneration. A Chunk evicted and loaded again gets a new one,
+    // so a mesh built for the old Chunk is never given to the new.
+    std::unordered_map<int64_t, uint64_t> m_chunkGenerations;
+    uint64_t m_nextGeneration;
+    // How newly built Chunk meshes are generated
+    MeshMode m_meshMode;
+    // Accumulated by draw() since the last resetDrawStats()
+    DrawStats m_drawStats;
+    LoadStats m_loadStats;
 
     OpenGLContext* mp_context;
+    // Holds every Chunk's mesh on the GPU and draws them in batches
+    ChunkRenderer m_renderer;
+    // Decides the blocks of newly generated Chunks
+    TerrainGenerator m_generator;
+
+    // Chunks whose blocks have been filled in by a worker thread but that
+    // have not yet been inserted into m_chunks. Guarded by m_completedMutex,
+    // since the workers push into it while the main thread drains it.
+    std::vector<uPtr<Chunk>> m_completedChunks;
+    // A mesh built by a worker thread for the given generation of the
+    // Chunk at key
+    struct BuiltMesh {
+        int64_t key;
+        uint64_t generation;
+        uPtr<ChunkMesh> mesh;
+    };
+    // Meshes waiting to be uploaded on the GL thread. Also guarded by
+    // m_completedMutex.
+    std::vector<BuiltMesh> m_completedMeshes;
+    std::mutex m_completedMutex;
+
+    // Where Chunks are saved, or null if the world isn't saved at all
+    uPtr<RegionStorage> m_storage;
+
+    // Background threads that run procedural generation.
+    // Declared last so that it is destroyed (and its threads joined)
+    // before any of the state its jobs write to.
+    WorkerPool m_workers;
 
-    // TODO: DELETE ALL REFERENCES TO m_geomCube AS YOU WILL NOT USE
-    // IT IN YOUR FINAL PROGRAM!
-    // The instance of a unit cube we can use to render any cube.
-    // Presently, Terrain::draw renders one instance of this cube
-    // for every non-EMPTY block within its Chunks. This is horribly
-    // inefficient, and will cause your game to run very slowly until
-    // milestone 1's Chunk VBO setup is completed.
-    Cube m_geomCube;
+    // Stores the given Chunk in m_chunks and links it to any
+    // neighboring Chunks that already exist.
+    Chunk* insertChunk(uPtr<Chunk> chunk);
+
+    // Fills in a Chunk's blocks from disk if it has been saved before, and
+    // generates them otherwise. Safe to call from a worker thread on a
+    // Chunk that isn't in m_chunks yet.
+    void loadOrGenerate(Chunk *chunk);
+
+    // Flags the Chunk at these Chunk-corner coordinates, if any, as
+    // needing a new mesh
+    void markChunkDirty(int x, int z);
+    // Snapshots the Chunk at these Chunk-corner coordinates and queues its
+    // mesh build, unless it is up to date or already being meshed
+    void requestMesh(int x, int z);
+    // Saves the zone's modified Chunks and unloads all 16 of them, freeing
+    // their meshes and unlinking their neighbors. Returns false, leaving
+    // the zone loaded, if a modified Chunk can't be saved.
+    bool evictZone(int zoneX, int zoneZ);
+
+    // Flood fills the 16 x 16 x 16 sections of the Chunks in the given bounds,
+    // starting from the one containing eye and only passing between sections
+    // through faces that their SectionVisibility connects. Returns, for each
+    // Chunk key, a mask with bit s set if section s might be visible.
+    std::unordered_map<int64_t, uint16_t> findVisibleSections(int minX, int maxX, int minZ, int maxZ,
+                                                               const Frustum &frustum, const glm::vec3 &eye) const;
+    // Queues the runs of the given sections of one of a Chunk's meshes
+    // with the renderer
+    void queueSections(Chunk &chunk, uint16_t sections, bool transparent);
 
 public:
     Terrain(OpenGLContext *context);
+    // Saves every modified Chunk and frees every Chunk's GPU buffers,
+    // so the GL context must be current
     ~Terrain();
 
+    // Saves Chunks to, and loads them from, the region files in directory
+    // from now on. Call before any terrain is requested. Returns false if
+    // the directory can't be created.
+    bool openWorld(const std::string &directory);
+    // Writes at most maxChunks modified Chunks to disk, if a world is
+    // open. Returns the number of Chunks saved.
+    int saveModifiedChunks(unsigned int maxChunks);
+
+    // Sets how far from the player zones stay loaded, in blocks, and how
+    // many bytes all loaded Chunks and their meshes may take up
+    void setEvictionLimits(int radius, size_t memoryBudget);
+    // Unloads at most maxZones fully loaded zones that lie outside the
+    // eviction radius, farthest first, then, while over the memory budget,
+    // the ones drawn least recently. Zones within reach of the player's
+    // 3 x 3 draw window are never unloaded. Returns the number unloaded.
+    int evictChunks(glm::vec3 playerPos, unsigned int maxZones);
+    // Bytes held by every loaded Chunk and its mesh, as counted against
+    // the memory budget
+    size_t getMemoryBytes() const;
+    unsigned int getChunkCount() const;
+
+    // Creates the buffers that Chunk meshes are uploaded into.
+    // Call once the GL context exists, before any mesh is uploaded.
+    void initializeGL();
+
     // Instantiates a new Chunk and stores it in
     // our chunk map at the given coordinates.
     // Returns a pointer to the created Chunk.
@@ -84,36 +221,59 @@ public:
     // Given a world-space coordinate (which may have negative
     // values) set the block at that point in space to the
     // given type.
+    // The affected Chunk (and any neighbor sharing the edited
+    // border) is flagged to be remeshed.
     void setBlockAt(int x, int y, int z, BlockType t);
+    // Switches the meshing algorithm and flags every Chunk to be remeshed with it
+    void setMeshMode(MeshMode mode);
+    MeshMode getMeshMode() const;
+    // Sums the statistics of every Chunk's current mesh
+    MeshStats getMeshStats() const;
+    // Are the Chunks within radius blocks of p (on the x-z plane) all loaded?
+    bool hasChunksAround(glm::vec3 p, int radius) const;
 
-    void checkForNewChunks();
+    // Loads (or remeshes) the Chunks around the one containing playerPos
+    void checkForNewChunks(glm::vec3 playerPos);
+    // Queues the Chunk's zone to be read from disk, or generated where it
+    // was never saved, if it isn't loaded; otherwise remeshes it if needed
     void checkAndLoadChunk(int x, int z);
-    glm::vec2 getChunkPos();
-    glm::vec2 getTerrainPos();
+    // Corners of the Chunk and the terrain generation zone containing playerPos
+    glm::vec2 getChunkPos(glm::vec3 playerPos);
+    glm::vec2 getTerrainPos(glm::vec3 playerPos);
 
     // Draws every Chunk that falls within the bounding box
     // described by the min and max coords, using the provided
-    // ShaderProgram
-    void draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram);
+    // ShaderProgram. Chunks whose meshes lie entirely outside
+    // the frustum are skipped, as are sections that cannot be
+    // seen from the eye position through the terrain. The opaque and
+    // transparent passes are timed by profiler if one is given.
+    void draw(int minX, int maxX, int minZ, int maxZ, ShaderProgram *shaderProgram,
+              const Frustum &frustum, const glm::vec3 &eye, GpuProfiler *profiler = nullptr);
+    // Clears the drawn / culled counts; call once at the start of each frame
+    void resetDrawStats();
+    const DrawStats& getDrawStats() const;
+    const LoadStats& getLoadStats() const;
+    // Occupancy of the shared buffers holding every Chunk's mesh
+    ArenaStats getVertexArenaStats() const;
+    ArenaStats getIndexArenaStats() const;
 
     // Initializes the Chunks that store the 64 x 256 x 64 block scene you
     // see when the base code is run.
     void CreateTestScene();
 
+    // Synchronously loads or generates every Chunk in the given bounds.
+    // The game itself uses requestTerrainZone() instead.
     void CreateProceduralTerrain(int,int,int,int);
 
-    int calcHeight(int x, int z, float b, float);
-    BlockType biomeBlock(int x, int y, int z, int maxY, float b,float);
-    float PerlinNoise(vec2 uv);
-    float surflet(vec2 P, vec2 gridPoint);
-    vec2 random2( vec2 p );
-    float fbm(vec2 uv);
-    float noise(vec2 uv);
-    vec2 smoothF(vec2 uv);
-    float WorleyNoise(vec2 uv);
-
-    vec3 random3( vec3 p );
-    float surflet(vec3 p, vec3 gridPoint);
-    float perlinNoise3D(vec3 p);
-    vec3 pow(vec3,float);
+    // Queues the 4 x 4 Chunks of the terrain generation zone containing
+    // (x, z) to be loaded or generated on the worker threads. Returns immediately;
+    // the Chunks show up in m_chunks once insertGeneratedChunks() picks them up.
+    void requestTerrainZone(int x, int z);
+    // Moves at most maxChunks finished Chunks from the worker threads into
+    // m_chunks. Must be called from the main thread. Returns the number
+    // of Chunks inserted.
+    int insertGeneratedChunks(unsigned int maxChunks);
+    // Uploads at most maxMeshes meshes that the worker threads have finished
+    // building. GL thread only. Returns the number of meshes uploaded.
+    int uploadBuiltMeshes(unsigned int maxMeshes);
 };
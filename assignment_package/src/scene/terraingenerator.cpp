@@ -0,0 +1,339 @@
+#include "terraingenerator.h"
+#include "tracer.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+GenerationStats& GenerationStats::operator+=(const GenerationStats &other) {
+    biomeNanos += other.biomeNanos;
+    heightNanos += other.heightNanos;
+    caveNanos += other.caveNanos;
+    storeNanos += other.storeNanos;
+    chunks += other.chunks;
+    return *this;
+}
+
+void TerrainGenerator::generateChunkBlocks(Chunk* chunk, int minX, int minZ, GenerationStats *stats) const {
+    TRACE_SCOPE("TerrainGenerator::generateChunkBlocks");
+    // Only read the clock when someone is keeping count
+    std::chrono::steady_clock::time_point last;
+    auto lap = [&](int64_t GenerationStats::*stage) {
+        if (stats) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            stats->*stage += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            last = now;
+        }
+    };
+    if (stats) {
+        last = std::chrono::steady_clock::now();
+        stats->chunks++;
+    }
+
+    // Create the basic terrain floor
+    for(int x = minX; x < minX + 16; x ++) {
+        for(int z = minZ; z < minZ + 16; z ++) {
+            float b1 = glm::smoothstep(0.25f, 0.75f, PerlinNoise(vec2(x,z)/1.f));
+            float b2 = glm::smoothstep(0.25f, 0.75f, PerlinNoise(vec2(x,z)/1024.f + 1323112334432432.f));
+            lap(&GenerationStats::biomeNanos);
+            int Y = calcHeight(x,z,b1,b2);
+            lap(&GenerationStats::heightNanos);
+
+            // Every block above bedrock and at or below this is carved
+            // by the caves. The column is worked out in full before any
+            // of it is stored, so that each stage is timed on its own.
+            int caveTop = std::min(Y, 128);
+            int top = std::min(std::max(Y, 138), 255);
+            std::array<BlockType, 256> column;
+            column[0] = biomeBlock(x,0,z,Y,b1,b2);
+            for(int y = std::max(caveTop + 1, 1);y<=top;y++){
+                column[y] = biomeBlock(x,y,z,Y,b1,b2);
+            }
+            lap(&GenerationStats::biomeNanos);
+            for(int y = 1;y<=caveTop;y++){
+                column[y] = caveBlock(x,y,z,Y,b2);
+            }
+            lap(&GenerationStats::caveNanos);
+            for(int y = 0;y<=top;y++){
+                chunk->setBlockAt(x - minX, y, z - minZ, column[y]);
+            }
+            lap(&GenerationStats::storeNanos);
+        }
+    }
+    // Nothing is written above max(Y, 138), and EMPTY written into an
+    // empty section doesn't allocate it, so the sky stays unallocated.
+    // Compacting frees what the caves emptied and collapses solid rock.
+    chunk->compactBlocks();
+    lap(&GenerationStats::storeNanos);
+}
+
+vec2 TerrainGenerator::smoothF(vec2 uv) const
+{
+    return uv*uv*(3.f-2.f*uv);
+}
+
+float TerrainGenerator::noise(vec2 uv) const
+{
+    const float k = 257.;
+    vec4 l  = vec4(floor(uv),fract(uv));
+    float u = l.x + l.y * k;
+    vec4 v  = vec4(u, u+1.,u+k, u+k+1.);
+    v       = fract(fract(1.23456789f *v)*v/.987654321f);
+    vec2 L    = smoothF(vec2(l[2],l[3]));
+    l.x     = mix(v.x, v.y, L[0]);
+    l.y     = mix(v.z, v.w, L[0]);
+    return    mix(l.x, l.y, L[1]);
+}
+
+float TerrainGenerator::fbm(vec2 uv) const
+{
+    float a = 0.5;
+    float f = 5.0;
+    float n = 0.;
+    int it = 8;
+    for(int i = 0; i < 32; i++)
+    {
+        if(i<it)
+        {
+            n += noise(uv*f)*a;
+            a *= .5;
+            f *= 2.;
+        }
+    }
+    return n;
+}
+
+float TerrainGenerator::WorleyNoise(vec2 uv) const
+{
+    // Tile the space
+    //    uv = uv + fbm2(uv / 4) * 5.f;
+    vec2 uvInt = floor(uv);
+    vec2 uvFract = fract(uv);
+
+    float minDist = 1.0; // Minimum distance initialized to max.
+    float secondMinDist = 1.0;
+    vec2 closestPoint;
+
+    // Search all neighboring cells and this cell for their point
+    for(int y = -1; y <= 1; y++)
+    {
+        for(int x = -1; x <= 1; x++)
+        {
+            vec2 neighbor = vec2(float(x), float(y));
+
+            // Random point inside current neighboring cell
+            vec2 point = random2(uvInt + neighbor);
+
+            // Compute the distance b/t the point and the fragment
+            // Store the min dist thus far
+            vec2 diff = neighbor + point - uvFract;
+            float dist = length(diff);
+            if(dist < minDist) {
+                secondMinDist = minDist;
+                minDist = dist;
+                closestPoint = point;
+            }
+            else if(dist < secondMinDist) {
+                secondMinDist = dist;
+            }
+        }
+    }
+    float height;// = 0.5 * minDist + 0.5 * secondMinDist;
+    height = minDist;
+    //    height = height * height;
+    return height;
+}
+
+int TerrainGenerator::calcHeight(int x, int z, float b1, float b2) const{
+    vec2 xz = vec2(x,z);
+
+    float h = 0;
+
+    float amp = 1/2.0;
+    float freq1 = 256;
+    float freq2 = 64;
+
+    for(int i = 0; i < 4; ++i) {
+        vec2 offset = vec2((float)fbm(xz / 256.f), (float)fbm(xz / 300.f))+ vec2(1000);
+
+        float h1 = PerlinNoise((xz + offset * 75.f) / freq1);
+
+        h += h1 * amp;
+
+        amp *= 0.5;
+        freq1 *= 0.5;
+    }
+
+    float H = 0;
+    amp = 1/2.0;
+    for(int i = 0; i < 4; ++i) {
+        float h2 = WorleyNoise(xz / freq2);
+
+        H += h2 * amp;
+
+        amp *= 0.5;
+        freq2 *= 0.5;
+    }
+
+    float v = mix(h,H,b1);
+
+
+    h = 0;
+    amp = 1/2.0;
+    freq1 = 512;
+    freq2 = 128;
+
+    for(int i = 0; i < 4; ++i) {
+        vec2 offset = vec2((float)fbm(xz / 2560.f), (float)fbm(xz / 3000.f));
+
+        float h1 = PerlinNoise((xz + offset * 175.f) / freq1);
+
+        h += h1 * amp;
+
+        amp *= 0.5;
+        freq1 *= 0.5;
+    }
+
+    H = 0;
+    amp = 1/2.0;
+    for(int i = 0; i < 4; ++i) {
+        float h2 = WorleyNoise(xz / freq2)*0.2;
+
+        H += h2 * amp;
+
+        amp *= 0.5;
+        freq2 *= 0.5;
+    }
+
+    v = floor(128+mix(v,mix(h,H,b1), b2)*128);
+    return v;
+}
+
+float TerrainGenerator::surflet(vec2 P, vec2 gridPoint) const
+{
+    // Compute falloff function by converting linear distance to a polynomial (quintic smootherstep function)
+    float distX = abs(P.x - gridPoint.x);
+    float distY = abs(P.y - gridPoint.y);
+    float tX = 1 - 6 * std::pow(distX, 5.0) + 15 * std::pow(distX, 4.0) - 10 * std::pow(distX, 3.0);
+    float tY = 1 - 6 * std::pow(distY, 5.0) + 15 * std::pow(distY, 4.0) - 10 * std::pow(distY, 3.0);
+
+    // Get the random vector for the grid point
+    vec2 gradient = random2(gridPoint);
+    // Get the vector from the grid point to P
+    vec2 diff = P - gridPoint;
+    // Get the value of our height field by dotting grid->P with our gradient
+    float height = dot(diff, gradient);
+    // Scale our height field (i.e. reduce it) by our polynomial falloff function
+    return height * tX * tY;
+}
+
+vec2 TerrainGenerator::random2( vec2 p ) const {
+    return normalize(2.f * (glm::fract(sin(vec2(dot(p,vec2(127.1,311.7)),dot(p,vec2(269.5,183.3))))
+                                       * 43758.5453f)) - 1.f);
+}
+
+float TerrainGenerator::PerlinNoise(vec2 uv) const
+{
+    // Tile the space
+    vec2 uvXLYL = floor(uv);
+    vec2 uvXHYL = uvXLYL + vec2(1,0);
+    vec2 uvXHYH = uvXLYL + vec2(1,1);
+    vec2 uvXLYH = uvXLYL + vec2(0,1);
+
+    return surflet(uv, uvXLYL) + surflet(uv, uvXHYL) + surflet(uv, uvXHYH) + surflet(uv, uvXLYH);
+}
+
+vec3 TerrainGenerator::random3( vec3 p ) const {
+    return fract(sin(vec3(dot(p,vec3(127.1, 311.7, 321.5)),
+                          dot(p,vec3(269.5, 183.3,43243.0)),
+                          dot(p, vec3(420.6, 631.2,321.43))
+                          )) * 43758.5453f);
+}
+
+
+vec3 TerrainGenerator::pow(vec3 v, float f) const
+{
+    return vec3(std::pow(v[0],f),std::pow(v[1],f),std::pow(v[2],f));
+}
+
+float TerrainGenerator::surflet(vec3 p, vec3 gridPoint) const {
+    // Compute the distance between p and the grid point along each axis, and warp it with a
+    // quintic function so we can smooth our cells
+    vec3 t2 = abs(p - gridPoint);
+    vec3 t = vec3(1.f) - 6.f * pow(t2, 5.f) + 15.f * pow(t2, 4.f) - 10.f * pow(t2, 3.f);//+20.f*pow(t2,2.f);
+    // Get the random vector for the grid point (assume we wrote a function random2
+    // that returns a vec2 in the range [0, 1])
+    vec3 gradient = random3(gridPoint) * 2.f - vec3(1., 1., 1.);
+    // Get the vector from the grid point to P
+    vec3 diff = p - gridPoint;
+    // Get the value of our height field by dotting grid->P with our gradient
+    float height = dot(diff, gradient);
+    // Scale our height field (i.e. reduce it) by our polynomial falloff function
+    //    std::cout<<height<<t[0]<<t[1]<<t[2]<<std::endl;
+    return height * t.x * t.y * t.z;
+}
+
+
+float TerrainGenerator::perlinNoise3D(vec3 p) const {
+    float surfletSum = 0.f;
+    // Iterate over the four integer corners surrounding uv
+    for(int dx = 0; dx <= 1; ++dx) {
+        for(int dy = 0; dy <= 1; ++dy) {
+            for(int dz = 0; dz <= 1; ++dz) {
+                float s = surflet(p, floor(p) + vec3(dx, dy, dz));
+                //                std::cout<<s<<std::endl;
+                surfletSum += s;
+            }
+        }
+    }
+    return surfletSum;
+}
+
+
+BlockType TerrainGenerator::biomeBlock(int x, int y, int z, int maxY, float b1, float b2) const{
+    if(y==0)
+        return BEDROCK;
+    if (y<=128 && y<=maxY)
+        return caveBlock(x,y,z,maxY,b2);
+    if(b2<0.5){
+        if(y>maxY)
+            return WATER;
+        if(b1<0.5){
+            if(y==maxY)
+                return GRASS;
+            return DIRT;
+        }
+        else{
+            if (y>=200 && y==maxY)
+                return SNOW;
+            float h = WorleyNoise(vec2(x,z)/64.f);
+            return h<0.95?STONE:DIRT;
+        }
+    }
+    else{
+        if(b1<0.5){
+            if(y>maxY)
+                return EMPTY;
+            return y<maxY-3?STONE:SAND;
+        }
+        else{
+            if(y>maxY)
+                return ICE;
+            return y<maxY-5?STONE:SNOW;
+        }
+    }
+}
+
+BlockType TerrainGenerator::caveBlock(int x, int y, int z, int maxY, float b2) const{
+    vec3 v = vec3(x,y,z);
+    float freq1 = 64;
+    float freq2 = 16;
+    vec2 xz = vec2(x,z);
+    vec3 offset = vec3((float)fbm(xz / 256.f),0, (float)fbm(xz / 300.f))+ vec3(1000);
+    float p1 =perlinNoise3D((v+offset)/freq1);
+    float p2 =perlinNoise3D((v+offset)/freq2);
+    if (!(p1<= -0.35 || abs(p2)<0.125))
+        return STONE;
+    // Low caves flood with lava, and below sea level those in the first
+    // biome fill with water
+    return y<=25?LAVA: b2<0.5 && maxY<128?WATER: EMPTY;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "glm_includes.h"
+#include "chunk.h"
+#include <cstdint>
+
+using namespace glm;
+
+// Time TerrainGenerator::generateChunkBlocks spent in each stage, summed
+// over every Chunk it was passed to
+struct GenerationStats {
+    // The two biome noise fields and the blocks above the cave layer,
+    // whose types they pick
+    int64_t biomeNanos = 0;
+    // calcHeight()
+    int64_t heightNanos = 0;
+    // caveBlock() for the blocks between bedrock and the cave ceiling
+    int64_t caveNanos = 0;
+    // Writing the finished columns into the Chunk and compacting it
+    int64_t storeNanos = 0;
+    unsigned int chunks = 0;
+
+    GenerationStats& operator+=(const GenerationStats &other);
+};
+
+// The procedural noise that decides every block of the world. Holds no
+// state and needs no GL or Terrain, so any number of threads may use one
+// generator at once, and it can be benchmarked on its own.
+class TerrainGenerator {
+public:
+    // Fills in the blocks of the Chunk whose lower-left corner is at (minX, minZ).
+    // Only touches the given Chunk, so it is safe to call from a worker thread
+    // as long as the Chunk is not yet visible to the rest of the Terrain.
+    // Adds the time spent on each stage to stats when given.
+    void generateChunkBlocks(Chunk* chunk, int minX, int minZ, GenerationStats *stats = nullptr) const;
+
+    int calcHeight(int x, int z, float b, float) const;
+    BlockType biomeBlock(int x, int y, int z, int maxY, float b,float) const;
+    // What biomeBlock() gives the blocks it passes through the 3D cave
+    // noise, those with 0 < y <= min(128, maxY)
+    BlockType caveBlock(int x, int y, int z, int maxY, float b2) const;
+    float PerlinNoise(vec2 uv) const;
+    float surflet(vec2 P, vec2 gridPoint) const;
+    vec2 random2( vec2 p ) const;
+    float fbm(vec2 uv) const;
+    float noise(vec2 uv) const;
+    vec2 smoothF(vec2 uv) const;
+    float WorleyNoise(vec2 uv) const;
+
+    vec3 random3( vec3 p ) const;
+    float surflet(vec3 p, vec3 gridPoint) const;
+    float perlinNoise3D(vec3 p) const;
+    vec3 pow(vec3,float) const;
+};
@@ -0,0 +1,64 @@
+#include "workerpool.h"
+#include "tracer.h"
+
+WorkerPool::WorkerPool(unsigned int numThreads)
+    : m_threads(), m_jobs(), m_mutex(), m_condition(), m_stopping(false)
+{
+    if (numThreads == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        // Leave one core for the render thread, but always have at least one worker
+        numThreads = cores > 1 ? cores - 1 : 1;
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+        m_threads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_jobs.clear();
+    }
+    m_condition.notify_all();
+
+    for (std::thread &t : m_threads) {
+        t.join();
+    }
+}
+
+void WorkerPool::enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+size_t WorkerPool::pendingJobs() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+unsigned int WorkerPool::threadCount() const {
+    return static_cast<unsigned int>(m_threads.size());
+}
+
+void WorkerPool::workerLoop() {
+    Tracer::setThreadName("Worker");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        // Run the job outside the lock so other workers can keep dequeuing
+        job();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size pool of background threads that run queued jobs in
+// the order they were submitted. Terrain uses this to generate Chunks
+// away from the GL thread.
+// Jobs must never call OpenGL functions: the GL context is only current
+// on the main thread, so anything that needs it has to be handed back
+// to the main thread (e.g. through a completion queue) first.
+class WorkerPool {
+private:
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+
+    // Body of every worker thread: pop jobs until the pool is destroyed
+    void workerLoop();
+
+public:
+    // Spawns numThreads workers. Passing 0 picks one thread per
+    // hardware core, minus one for the main (render) thread.
+    WorkerPool(unsigned int numThreads = 0);
+    // Discards any jobs that have not started yet and joins every worker
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Queue a job to be run on one of the worker threads
+    void enqueue(std::function<void()> job);
+    // The number of queued jobs that no worker has picked up yet
+    size_t pendingJobs();
+    unsigned int threadCount() const;
+};
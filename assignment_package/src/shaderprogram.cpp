@@ -1,5 +1,6 @@
 #include "shaderprogram.h"
 #include "drawable.h"
+#include "frameuniforms.h"
 #include <QFile>
 #include <QStringBuilder>
 #include <QTextStream>
@@ -9,12 +10,28 @@
 
 ShaderProgram::ShaderProgram(OpenGLContext *context)
     : vertShader(), fragShader(), prog(),
-      attrPos(-1), attrNor(-1), attrCol(-1), attrUV(-1),
-      unifModel(-1), unifModelInvTr(-1), unifViewProj(-1), unifColor(-1), unifSampler2D(-1),
-      unifRendered2D(-1), unifTime(-1),
+      attrPos(-1), attrNor(-1), attrCol(-1), attrUV(-1), attrPosOffset(-1), attrPacked(-1), attrChunkOrigin(-1),
+      unifModel(-1), unifModelInvTr(-1), unifColor(-1), unifBlockColors(-1), unifSampler2D(-1),
+      unifRendered2D(-1),
       context(context)
 {}
 
+// GLSL has no #include, so the FrameData block the shaders share is kept
+// in one file and pasted in wherever a shader includes it
+static QString withFrameData(QString source)
+{
+    static const QString directive("#include \"framedata.glsl\"");
+    if (!source.contains(directive)) {
+        return source;
+    }
+    QFile file(":/glsl/framedata.glsl");
+    if (!file.open(QFile::ReadOnly)) {
+        throw std::runtime_error("Could not read glsl/framedata.glsl");
+    }
+    QTextStream in(&file);
+    return source.replace(directive, in.readAll());
+}
+
 void ShaderProgram::create(const char *vertfile, const char *fragfile)
 {
     // Allocate space on our GPU for a vertex shader and a fragment shader and a shader program to manage the two
@@ -22,8 +39,8 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
     fragShader = context->glCreateShader(GL_FRAGMENT_SHADER);
     prog = context->glCreateProgram();
     // Get the body of text stored in our two .glsl files
-    QString qVertSource = qTextFileRead(vertfile);
-    QString qFragSource = qTextFileRead(fragfile);
+    QString qVertSource = withFrameData(qTextFileRead(vertfile));
+    QString qFragSource = withFrameData(qTextFileRead(fragfile));
 
     char* vertSource = new char[qVertSource.size()+1];
     strcpy(vertSource, qVertSource.toStdString().c_str());
@@ -60,6 +77,17 @@ void ShaderProgram::create(const char *vertfile, const char *fragfile)
         printLinkInfoLog(prog);
     }
 
+    context->labelObject(GL_SHADER, vertShader, vertfile);
+    context->labelObject(GL_SHADER, fragShader, fragfile);
+    context->labelObject(GL_PROGRAM, prog, std::string(vertfile) + " + " + fragfile);
+
+    // Read the per-frame values from the shared uniform buffer, if this
+    // program uses any of them
+    GLuint frameBlock = context->glGetUniformBlockIndex(prog, "FrameData");
+    if (frameBlock != GL_INVALID_INDEX) {
+        context->glUniformBlockBinding(prog, frameBlock, FrameUniforms::FRAME_DATA_BINDING);
+    }
+
     // Get the handles to the variables stored in our shaders
     // See shaderprogram.h for more information about these variables
     setupMemberVars();
@@ -73,20 +101,20 @@ void ShaderProgram::setupMemberVars(){
     attrUV = context->glGetAttribLocation(prog, "vs_UV");
     if(attrUV == -1) attrUV = context->glGetAttribLocation(prog, "vs_UVInstanced");
     attrPosOffset = context->glGetAttribLocation(prog, "vs_OffsetInstanced");
+    attrPacked = context->glGetAttribLocation(prog, "vs_Packed");
+    attrChunkOrigin = context->glGetAttribLocation(prog, "vs_ChunkOrigin");
 
     unifModel      = context->glGetUniformLocation(prog, "u_Model");
     unifModelInvTr = context->glGetUniformLocation(prog, "u_ModelInvTr");
-    unifViewProj   = context->glGetUniformLocation(prog, "u_ViewProj");
     unifColor      = context->glGetUniformLocation(prog, "u_Color");
+    unifBlockColors = context->glGetUniformLocation(prog, "u_BlockColors");
     unifSampler2D = context->glGetUniformLocation(prog, "u_Texture");
     unifRendered2D = context->glGetUniformLocation(prog, "u_RenderedTexture");
-    unifTime = context->glGetUniformLocation(prog, "u_Time");
 
     // Sky shader
     unifDimensions = context->glGetUniformLocation(prog, "u_Dimensions");
     unifEye = context->glGetUniformLocation(prog, "u_Eye");
     unifTimeSky = context->glGetUniformLocation(prog, "u_TimeSky");
-    unifSunDir = context->glGetUniformLocation(prog, "u_SunDir");
 }
 
 void ShaderProgram::useMe()
@@ -94,15 +122,6 @@ void ShaderProgram::useMe()
     context->glUseProgram(prog);
 }
 
-void ShaderProgram::setTime(int t) {
-    useMe();
-
-    if(unifTime != -1)
-    {
-        context->glUniform1i(unifTime, t);
-    }
-}
-
 void ShaderProgram::setModelMatrix(const glm::mat4 &model)
 {
     useMe();
@@ -133,31 +152,23 @@ void ShaderProgram::setModelMatrix(const glm::mat4 &model)
     }
 }
 
-void ShaderProgram::setViewProjMatrix(const glm::mat4 &vp)
+void ShaderProgram::setGeometryColor(glm::vec4 color)
 {
-    // Tell OpenGL to use this shader program for subsequent function calls
     useMe();
 
-    if(unifViewProj != -1) {
-    // Pass a 4x4 matrix into a uniform variable in our shader
-                    // Handle to the matrix variable on the GPU
-    context->glUniformMatrix4fv(unifViewProj,
-                    // How many matrices to pass
-                       1,
-                    // Transpose the matrix? OpenGL uses column-major, so no.
-                       GL_FALSE,
-                    // Pointer to the first element of the matrix
-                       &vp[0][0]);
+    if(unifColor != -1)
+    {
+        context->glUniform4fv(unifColor, 1, &color[0]);
     }
 }
 
-void ShaderProgram::setGeometryColor(glm::vec4 color)
+void ShaderProgram::setBlockColors(const std::vector<glm::vec4> &colors)
 {
     useMe();
 
-    if(unifColor != -1)
+    if(unifBlockColors != -1)
     {
-        context->glUniform4fv(unifColor, 1, &color[0]);
+        context->glUniform4fv(unifBlockColors, colors.size(), &colors[0][0]);
     }
 }
 
@@ -217,76 +228,6 @@ void ShaderProgram::draw(Drawable &d)
     context->printGLErrorLog();
 }
 
-void ShaderProgram::drawInterleaved(Drawable &d) {
-    useMe();
-
-    if (d.elemCount() < 0) {
-        throw std::out_of_range("Attempting to draw a drawable with m_count of " + std::to_string(d.elemCount()) + "!");
-    }
-
-    if (attrPos != -1 && d.bindVBO()) {
-        context->glEnableVertexAttribArray(attrPos);
-        context->glVertexAttribPointer(attrPos, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)0);
-    }
-    if (attrNor != -1 && d.bindVBO()) {
-        context->glEnableVertexAttribArray(attrNor);
-        context->glVertexAttribPointer(attrNor, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(sizeof(glm::vec4)));
-    }
-    if (attrCol != -1 && d.bindVBO()) {
-        context->glEnableVertexAttribArray(attrCol);
-        context->glVertexAttribPointer(attrCol, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(2 * sizeof(glm::vec4)));
-    }
-    if (attrUV != -1 && d.bindVBO()) {
-        context->glEnableVertexAttribArray(attrUV);
-        context->glVertexAttribPointer(attrUV, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(3 * sizeof(glm::vec4)));
-    }
-
-    d.bindIdx();
-    context->glDrawElements(d.drawMode(), d.elemCount(), GL_UNSIGNED_INT, 0);
-
-    if (attrPos != -1) context->glDisableVertexAttribArray(attrPos);
-    if (attrNor != -1) context->glDisableVertexAttribArray(attrNor);
-    if (attrCol != -1) context->glDisableVertexAttribArray(attrCol);
-    if (attrUV != -1) context->glDisableVertexAttribArray(attrUV);
-
-    context->printGLErrorLog();
-}
-
-void ShaderProgram::drawTpInterleaved(Drawable &d) {
-    useMe();
-
-    if (d.elemCount() < 0) {
-        throw std::out_of_range("Attempting to draw a drawable with m_count of " + std::to_string(d.elemCount()) + "!");
-    }
-
-    if (attrPos != -1 && d.bindTpVBO()) {
-        context->glEnableVertexAttribArray(attrPos);
-        context->glVertexAttribPointer(attrPos, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)0);
-    }
-    if (attrNor != -1 && d.bindTpVBO()) {
-        context->glEnableVertexAttribArray(attrNor);
-        context->glVertexAttribPointer(attrNor, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(sizeof(glm::vec4)));
-    }
-    if (attrCol != -1 && d.bindTpVBO()) {
-        context->glEnableVertexAttribArray(attrCol);
-        context->glVertexAttribPointer(attrCol, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(2 * sizeof(glm::vec4)));
-    }
-    if (attrUV != -1 && d.bindTpVBO()) {
-        context->glEnableVertexAttribArray(attrUV);
-        context->glVertexAttribPointer(attrUV, 4, GL_FLOAT, false, 4 * sizeof(glm::vec4), (void*)(3 * sizeof(glm::vec4)));
-    }
-
-    d.bindTpIdx();
-    context->glDrawElements(d.drawMode(), d.tpElemCount(), GL_UNSIGNED_INT, 0);
-
-    if (attrPos != -1) context->glDisableVertexAttribArray(attrPos);
-    if (attrNor != -1) context->glDisableVertexAttribArray(attrNor);
-    if (attrCol != -1) context->glDisableVertexAttribArray(attrCol);
-    if (attrUV != -1) context->glDisableVertexAttribArray(attrUV);
-
-    context->printGLErrorLog();
-}
-
 void ShaderProgram::drawInstanced(InstancedDrawable &d)
 {
     useMe();
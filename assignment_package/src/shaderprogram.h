@@ -4,6 +4,7 @@
 #include <openglcontext.h>
 #include <glm_includes.h>
 #include <glm/glm.hpp>
+#include <vector>
 
 #include "drawable.h"
 
@@ -22,21 +23,21 @@ public:
     int attrCol; // A handle for the "in" vec4 representing vertex color in the vertex shader
     int attrUV;
     int attrPosOffset; // A handle for a vec3 used only in the instanced rendering shader
+    int attrPacked; // A handle for the "in" uvec2 holding a packed Chunk vertex (see ChunkVertex)
+    int attrChunkOrigin; // A handle for the per-instance vec4 holding the world-space corner of the Chunk being drawn
 
     int unifModel; // A handle for the "uniform" mat4 representing model matrix in the vertex shader
     int unifModelInvTr; // A handle for the "uniform" mat4 representing inverse transpose of the model matrix in the vertex shader
-    int unifViewProj; // A handle for the "uniform" mat4 representing combined projection and view matrices in the vertex shader
     int unifColor; // A handle for the "uniform" vec4 representing color of geometry in the vertex shader
+    int unifBlockColors; // A handle for the "uniform" vec4 array of per-BlockType colors used by packed Chunk vertices
 
     int unifSampler2D; // A handle for the texture sampler
     int unifRendered2D;
-    int unifTime;
 
     // For sky code
     int unifDimensions;
     int unifEye;
     int unifTimeSky;
-    int unifSunDir;
 
 public:
     ShaderProgram(OpenGLContext* context);
@@ -45,20 +46,14 @@ public:
     virtual void setupMemberVars();
     // Tells our OpenGL context to use this shader to draw things
     void useMe();
-    // Set the time
-    void setTime(int t);
     // Pass the given model matrix to this shader on the GPU
     void setModelMatrix(const glm::mat4 &model);
-    // Pass the given Projection * View matrix to this shader on the GPU
-    void setViewProjMatrix(const glm::mat4 &vp);
     // Pass the given color to this shader on the GPU
     void setGeometryColor(glm::vec4 color);
+    // Pass the color of every BlockType, indexed by BlockType, to this shader on the GPU
+    void setBlockColors(const std::vector<glm::vec4> &colors);
     // Draw the given object to our screen using this ShaderProgram's shaders
     virtual void draw(Drawable &d);
-    // Draw object with interleaved VBO
-    void drawInterleaved(Drawable &d);
-    // Draw tp
-    void drawTpInterleaved(Drawable &d);
     // Draw the given object to our screen multiple times using instanced rendering
     void drawInstanced(InstancedDrawable &d);
     // Utility function used in create()
@@ -21,6 +21,17 @@ SOURCES += \
     $$PWD/scene/camera.cpp \
     $$PWD/playerinfo.cpp \
     $$PWD/scene/chunk.cpp \
+    $$PWD/scene/blocksection.cpp \
+    $$PWD/scene/workerpool.cpp \
+    $$PWD/scene/frustum.cpp \
+    $$PWD/bufferarena.cpp \
+    $$PWD/scene/chunkrenderer.cpp \
+    $$PWD/scene/terraingenerator.cpp \
+    $$PWD/scene/regionfile.cpp \
+    $$PWD/frameuniforms.cpp \
+    $$PWD/gpuprofiler.cpp \
+    $$PWD/inputlog.cpp \
+    $$PWD/tracer.cpp \
     $$PWD/texture.cpp
 
 HEADERS += \
@@ -33,6 +44,7 @@ HEADERS += \
     $$PWD/postprocessshader.h \
     $$PWD/scene/camera.h \
     $$PWD/scene/chunk.h \
+    $$PWD/scene/blocksection.h \
     $$PWD/scene/chunkhelpers.h \
     $$PWD/scene/cube.h \
     $$PWD/scene/entity.h \
@@ -62,4 +74,16 @@ HEADERS += \
     $$PWD/scene/camera.h \
     $$PWD/playerinfo.h \
     $$PWD/scene/chunk.h \
+    $$PWD/scene/blocksection.h \
+    $$PWD/scene/workerpool.h \
+    $$PWD/scene/frustum.h \
+    $$PWD/bufferarena.h \
+    $$PWD/arenahandle.h \
+    $$PWD/scene/chunkrenderer.h \
+    $$PWD/scene/terraingenerator.h \
+    $$PWD/scene/regionfile.h \
+    $$PWD/frameuniforms.h \
+    $$PWD/gpuprofiler.h \
+    $$PWD/inputlog.h \
+    $$PWD/tracer.h \
     $$PWD/texture.h
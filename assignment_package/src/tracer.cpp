@@ -0,0 +1,146 @@
+#include "tracer.h"
+#include "smartpointerhelp.h"
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace Tracer {
+
+std::atomic<bool> g_enabled(false);
+
+namespace {
+
+// How many events each thread can hold between a start() and a stop()
+const size_t EVENTS_PER_THREAD = 1 << 16;
+
+struct Event {
+    const char *name;
+    int64_t start;
+    int64_t duration;
+};
+
+// Written only by its own thread. The count is published with release
+// ordering after each event is filled in, so writeChromeTrace() can read
+// every event below it without locking.
+struct ThreadBuffer {
+    std::vector<Event> events;
+    std::atomic<size_t> count;
+    // Which start() the events belong to. The owning thread empties the
+    // buffer itself when it finds it is stale, so no one else ever writes
+    // to it.
+    std::atomic<unsigned int> session;
+    std::atomic<const char*> name;
+    int threadId;
+
+    ThreadBuffer(int id)
+        : events(EVENTS_PER_THREAD), count(0), session(0), name(nullptr), threadId(id)
+    {}
+};
+
+// Every thread's buffer, kept until exit so the trace can still be written
+// after a thread has finished
+std::mutex g_buffersMutex;
+std::vector<uPtr<ThreadBuffer>> g_buffers;
+std::atomic<unsigned int> g_session(0);
+
+const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+ThreadBuffer& threadBuffer() {
+    thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(g_buffersMutex);
+        g_buffers.push_back(mkU<ThreadBuffer>(static_cast<int>(g_buffers.size()) + 1));
+        buffer = g_buffers.back().get();
+    }
+    return *buffer;
+}
+
+void writeEscaped(std::ostream &out, const char *s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            out << '\\';
+        }
+        out << *s;
+    }
+    out << '"';
+}
+
+}
+
+void start() {
+    g_session.fetch_add(1, std::memory_order_relaxed);
+    g_enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop() {
+    g_enabled.store(false, std::memory_order_relaxed);
+}
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+void record(const char *name, int64_t startMicros, int64_t endMicros) {
+    ThreadBuffer &buffer = threadBuffer();
+    unsigned int session = g_session.load(std::memory_order_relaxed);
+    if (buffer.session.load(std::memory_order_relaxed) != session) {
+        buffer.count.store(0, std::memory_order_relaxed);
+        buffer.session.store(session, std::memory_order_release);
+    }
+
+    size_t count = buffer.count.load(std::memory_order_relaxed);
+    if (count == buffer.events.size()) {
+        return;
+    }
+    buffer.events[count] = Event{name, startMicros, endMicros - startMicros};
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void setThreadName(const char *name) {
+    threadBuffer().name.store(name, std::memory_order_relaxed);
+}
+
+bool writeChromeTrace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+
+    unsigned int session = g_session.load(std::memory_order_relaxed);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(g_buffersMutex);
+    for (const uPtr<ThreadBuffer> &buffer : g_buffers) {
+        // Threads that recorded nothing since the last start() still hold
+        // the events of an earlier one
+        if (buffer->session.load(std::memory_order_acquire) != session) {
+            continue;
+        }
+
+        const char *name = buffer->name.load(std::memory_order_relaxed);
+        if (name) {
+            out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << buffer->threadId << ",\"args\":{\"name\":";
+            writeEscaped(out, name);
+            out << "}}";
+            first = false;
+        }
+
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            const Event &event = buffer->events[i];
+            out << (first ? "" : ",") << "\n{\"name\":";
+            writeEscaped(out, event.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+            first = false;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+}
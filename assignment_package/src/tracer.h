@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Records how long scopes of code take on every thread, for viewing as a
+// timeline in chrome://tracing or Perfetto. Mark a scope with
+//     TRACE_SCOPE("TerrainGenerator::generateChunkBlocks");
+// and the time from there to the end of the enclosing block is recorded
+// while tracing is on. While it is off, a TRACE_SCOPE costs a relaxed
+// atomic load and a branch on entry, and a branch on exit.
+// Each thread appends to a buffer of its own that only it writes to, so
+// recording takes no locks; the only lock is taken the first time a thread
+// records anything, to register its buffer. Once a thread's buffer is full
+// its further events are dropped until the next start().
+namespace Tracer {
+
+// Only read this through enabled(); it is exposed so that check can be inlined
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+// Discards everything recorded so far and starts recording
+void start();
+// Stops recording, keeping what was recorded for writeChromeTrace()
+void stop();
+// Microseconds since the program started
+int64_t now();
+// Records a complete event. Names must outlive the trace, e.g. string literals.
+void record(const char *name, int64_t startMicros, int64_t endMicros);
+// Names the calling thread in the trace. Also a string literal.
+void setThreadName(const char *name);
+// Writes everything recorded since the last start() as Chrome trace-event
+// JSON. Call after stop(), from the thread that calls start() and stop().
+// Returns false if the file could not be written.
+bool writeChromeTrace(const std::string &path);
+
+}
+
+// Records the lifetime of a TRACE_SCOPE
+class TraceScope {
+private:
+    const char *m_name;
+    int64_t m_start;
+
+public:
+    explicit TraceScope(const char *name)
+        : m_name(name), m_start(Tracer::enabled() ? Tracer::now() : -1)
+    {}
+    ~TraceScope() {
+        if (m_start >= 0) {
+            Tracer::record(m_name, m_start, Tracer::now());
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)